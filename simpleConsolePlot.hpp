@@ -2,11 +2,30 @@
 #define SIMPLE_CONSOLE_PLOT_HPP
 
 #include <cstdio>
+#include <cstdarg>
+#include <algorithm>
 #include <cmath>
 #include <vector>
+#include <deque>
+#include <set>
 #include <limits>
+#include <memory>
 #include <unordered_map>
 #include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <cstdint>
 
 namespace SCP {
 
@@ -14,9 +33,357 @@ enum {BLACK, RED, GREEN, YELLOW, BLUE, MAGENTA, CYAN, BRIGHT_GRAY, DARK_GRAY,
 	BRIGHT_RED, BRIGHT_GREEN, BRIGHT_YELLOW, BRIGHT_BLUE, BRIGHT_MAGENTA,
 	BRIGHT_CYAN, WHITE};
 
+// True for numbers that are neither NaN nor infinite; x-x is NaN for both.
+inline bool finite(double x) {
+	return x-x == 0;
+}
+
+/**
+ * Streaming approximation of the distribution of values, from which any
+ * quantile can be read. It keeps a few hundred values in levels of growing
+ * weight (a KLL sketch), so memory stays bounded however many values are
+ * added, and two sketches can be merged into one describing both streams.
+ */
+class QuantileSketch {
+public:
+	/**
+	 * @param k Accuracy parameter; the rank error is roughly 1.7/k.
+	 */
+	QuantileSketch(int k = 200) : k(k) {}
+	
+	/**
+	 * Adds a value to the sketch.
+	 * @param v The value.
+	 */
+	void add(double v) {
+		if(levels.empty())
+			levels.resize(1);
+		
+		levels[0].push_back(v);
+		n++;
+		if(v < min) min = v;
+		if(v > max) max = v;
+		
+		if(levels[0].size() >= capacity(0))
+			compress();
+	}
+	
+	/**
+	 * Adds all values described by another sketch.
+	 * @param a The sketch to merge into this one.
+	 */
+	void merge(const QuantileSketch &a) {
+		if(a.levels.size() > levels.size())
+			levels.resize(a.levels.size());
+		
+		for(std::size_t l = 0; l < a.levels.size(); l++)
+			levels[l].insert(levels[l].end(), a.levels[l].begin(), a.levels[l].end());
+		
+		n += a.n;
+		if(a.min < min) min = a.min;
+		if(a.max > max) max = a.max;
+		compress();
+	}
+	
+	/**
+	 * Estimates the value below which the given fraction of values lies.
+	 * @param q The fraction, from 0 to 1.
+	 * @return The estimated value, NaN if the sketch is empty.
+	 */
+	double quantile(double q) const {
+		if(n == 0)
+			return std::numeric_limits<double>::quiet_NaN();
+		if(q <= 0)
+			return min;
+		if(q >= 1)
+			return max;
+		
+		std::vector<std::pair<double, uint64_t>> items;
+		uint64_t total = 0;
+		for(std::size_t l = 0; l < levels.size(); l++)
+			for(double v : levels[l]) {
+				items.push_back({v, uint64_t(1)<<l});
+				total += uint64_t(1)<<l;
+			}
+		
+		std::sort(items.begin(), items.end());
+		const double rank = q*total;
+		uint64_t seen = 0;
+		for(const auto &i : items) {
+			seen += i.second;
+			if(seen > rank)
+				return i.first;
+		}
+		return max;
+	}
+	
+	/**
+	 * @return The number of values added.
+	 */
+	uint64_t count() const {
+		return n;
+	}
+	
+	/**
+	 * Removes all values.
+	 */
+	void clear() {
+		levels.clear();
+		n = 0;
+		min = std::numeric_limits<double>::infinity();
+		max = -min;
+	}
+	
+private:
+	int k;
+	uint64_t n = 0;
+	double min = std::numeric_limits<double>::infinity(), max = -min;
+	uint32_t random = 0x9e3779b9;
+	std::vector<std::vector<double>> levels;
+	
+	std::size_t capacity(std::size_t level) const {
+		const double c = k*std::pow(2.0/3.0, levels.size()-1-level);
+		return c < 2 ? 2 : static_cast<std::size_t>(c);
+	}
+	
+	void compress() {
+		for(std::size_t l = 0; l < levels.size(); l++) {
+			if(levels[l].size() < capacity(l))
+				continue;
+			if(l+1 == levels.size())
+				levels.resize(l+2);
+			
+			std::vector<double> &v = levels[l];
+			std::sort(v.begin(), v.end());
+			random ^= random<<13;
+			random ^= random>>17;
+			random ^= random<<5;
+			
+			const std::size_t odd = v.size()%2;
+			for(std::size_t i = random&1; i < v.size()-odd; i += 2)
+				levels[l+1].push_back(v[i]);
+			
+			if(odd) {
+				const double last = v.back();
+				v.clear();
+				v.push_back(last);
+			}
+			else
+				v.clear();
+		}
+	}
+};
+
+/**
+ * Maps values to colors by splitting a range of values into equal parts,
+ * one for each color.
+ */
+struct Colormap {
+	std::vector<int8_t> colors;
+	double low, high;
+	
+	/**
+	 * @param colors The colors, from the lowest values to the highest.
+	 * @param low The value mapped to the first color; values below are clamped.
+	 * @param high The value mapped to the last color; values above are clamped.
+	 * When low equals high, users of the colormap pick the range of their data.
+	 */
+	Colormap(std::vector<int8_t> colors = {BLUE, CYAN, GREEN, YELLOW, RED}, 
+			 double low = 0, double high = 0) : colors(colors), low(low), high(high) {}
+	
+	/**
+	 * @return True if the range should be taken from the data.
+	 */
+	bool autoRange() const {
+		return low == high;
+	}
+	
+	/**
+	 * @param v The value.
+	 * @return The color of the value, using the given range; the first
+	 * color for NaN or when the range is empty.
+	 */
+	int8_t color(double v, double low, double high) const {
+		if(!(high > low) || v != v)
+			return colors[0];
+		
+		const int n = colors.size();
+		const double i = (v-low)*n/(high-low);
+		return colors[i < 0 ? 0 : i >= n ? n-1 : static_cast<int>(i)];
+	}
+	
+	/**
+	 * @param v The value.
+	 * @return The color of the value.
+	 */
+	int8_t color(double v) const {
+		return color(v, low, high);
+	}
+	
+	/**
+	 * Looks up the colors of many values at once. The bucket indexes are
+	 * computed in a branch-free loop before the colors are gathered. NaN
+	 * values, and all values when the range is empty, get the first color.
+	 * 
+	 * @param values The values.
+	 * @param out The colors of the values.
+	 * @param n The number of values.
+	 * @param low The value mapped to the first color.
+	 * @param high The value mapped to the last color.
+	 */
+	void map(const double *values, int8_t *out, std::size_t n, double low, double high) const {
+		if(!(high > low)) {
+			std::fill(out, out+n, colors[0]);
+			return;
+		}
+		
+		const double scale = colors.size()/(high-low), last = colors.size()-1;
+		int32_t index[256];
+		for(std::size_t i = 0; i < n; i += 256) {
+			const std::size_t m = std::min<std::size_t>(256, n-i);
+			for(std::size_t j = 0; j < m; j++) {
+				double t = (values[i+j]-low)*scale;
+				t = t >= 0 ? t : 0;
+				t = t < last ? t : last;
+				index[j] = static_cast<int32_t>(t);
+			}
+			for(std::size_t j = 0; j < m; j++)
+				out[i+j] = colors[index[j]];
+		}
+	}
+};
+
+/**
+ * Fast Fourier transform of a fixed power-of-two size (iterative radix-2).
+ * The twiddle factors and the bit-reversal permutation are computed once.
+ * Real and imaginary parts are kept in separate arrays, and the twiddles of
+ * each pass are stored contiguously, so that the butterflies of a pass run
+ * over consecutive elements.
+ */
+class FFT {
+public:
+	/**
+	 * @param n The size of the transform, a power of two.
+	 */
+	FFT(std::size_t n) : n(n), cos(2*n), sin(2*n), reversed(n) {
+		const double pi = std::acos(-1.0);
+		// The twiddles of the pass combining halves of size m are at [m, 2m);
+		// those at [n, 2n) are used to untangle real transforms.
+		for(std::size_t m = 1; m <= n; m *= 2)
+			for(std::size_t j = 0; j < m; j++) {
+				cos[m+j] = std::cos(pi*j/m);
+				sin[m+j] = -std::sin(pi*j/m);
+			}
+		
+		int bits = 0;
+		while((static_cast<std::size_t>(1)<<bits) < n)
+			bits++;
+		for(std::size_t i = 0; i < n; i++) {
+			std::size_t r = 0;
+			for(int b = 0; b < bits; b++)
+				r |= ((i>>b)&1)<<(bits-1-b);
+			reversed[i] = r;
+		}
+	}
+	
+	/**
+	 * @return The size of the transform.
+	 */
+	std::size_t size() const {
+		return n;
+	}
+	
+	/**
+	 * Transforms in place. The inverse transform is not scaled, so a forward
+	 * and an inverse transform multiply the data by the size.
+	 * 
+	 * @param re The real parts.
+	 * @param im The imaginary parts.
+	 * @param inverse Whether the inverse transform is computed.
+	 */
+	void transform(double *re, double *im, bool inverse = false) const {
+		for(std::size_t i = 0; i < n; i++) {
+			const std::size_t r = reversed[i];
+			if(i < r) {
+				std::swap(re[i], re[r]);
+				std::swap(im[i], im[r]);
+			}
+		}
+		
+		const double sign = inverse ? -1 : 1;
+		for(std::size_t m = 1; m < n; m *= 2) {
+			const double *wr = &cos[m], *wi = &sin[m];
+			for(std::size_t k = 0; k < n; k += 2*m) {
+				double *ar = re+k, *ai = im+k, *br = re+k+m, *bi = im+k+m;
+				for(std::size_t j = 0; j < m; j++) {
+					const double tr = br[j]*wr[j]-bi[j]*wi[j]*sign;
+					const double ti = br[j]*wi[j]*sign+bi[j]*wr[j];
+					br[j] = ar[j]-tr;
+					bi[j] = ai[j]-ti;
+					ar[j] += tr;
+					ai[j] += ti;
+				}
+			}
+		}
+	}
+	
+	/**
+	 * Transforms real data of twice the size, packed as even and odd values
+	 * into one complex transform of the size. Only the non-negative
+	 * frequencies are computed; the others are their complex conjugates.
+	 * 
+	 * @param in The 2*size() real values.
+	 * @param re The real parts of the size()+1 frequencies, from 0 to the Nyquist frequency.
+	 * @param im The imaginary parts of the frequencies.
+	 */
+	void transformReal(const double *in, double *re, double *im) const {
+		for(std::size_t i = 0; i < n; i++) {
+			re[i] = in[2*i];
+			im[i] = in[2*i+1];
+		}
+		transform(re, im);
+		
+		const double r0 = re[0], i0 = im[0];
+		re[0] = r0+i0;
+		re[n] = r0-i0;
+		im[0] = im[n] = 0;
+		for(std::size_t k = 1; k <= n/2; k++) {
+			const std::size_t l = n-k;
+			// Halves of the sum and the difference of Z[k] and conj(Z[n-k]),
+			// the transforms of the even and odd values.
+			const double er = (re[k]+re[l])/2, ei = (im[k]-im[l])/2;
+			const double or_ = (im[k]+im[l])/2, oi = (re[l]-re[k])/2;
+			const double wr = cos[n+k], wi = sin[n+k];
+			const double tr = wr*or_-wi*oi, ti = wr*oi+wi*or_;
+			re[k] = er+tr;
+			im[k] = ei+ti;
+			re[l] = er-tr;
+			im[l] = ti-ei;
+		}
+	}
+	
+private:
+	std::size_t n;
+	std::vector<double> cos, sin;
+	std::vector<std::size_t> reversed;
+};
+
+class Series;
+class Pipeline;
+class SharedFrameWriter;
+class Waterfall;
+class Presenter;
+
 class Plot {
+	friend class Series;
+	friend class Pipeline;
+	friend class Waterfall;
+	friend class Presenter;
+	friend class SharedFrameWriter;
+	
 public:
 	enum{EMPTY=' ', BLOCK='\0'};
+	enum Pooling {AVERAGE, MAXIMUM};
 	struct Cell {
 		char ch;
 		int8_t co;
@@ -41,6 +408,91 @@ public:
 		Point a, b;
 	};
 	
+	/**
+	 * Axis labels for one size, drawing range and format, formatted once and
+	 * kept as a single block of bytes whose spans are copied after each row.
+	 */
+	struct Labels {
+		int w, h;
+		Point topLeft;
+		double dx, dy;
+		std::string yFormat, xFormat;
+		std::string text;
+		std::vector<std::size_t> ends;
+		
+		/**
+		 * @param y Row of the buffer.
+		 * @return The encoded label of the row, empty without Y axis.
+		 */
+		std::string::const_iterator rowBegin(int y) const {
+			return text.begin()+(y ? ends[y-1] : 0);
+		}
+		
+		std::string::const_iterator rowEnd(int y) const {
+			return text.begin()+ends[y];
+		}
+		
+		/**
+		 * @return The encoded X axis, empty without X axis.
+		 */
+		std::string::const_iterator axisBegin() const {
+			return rowEnd(h-1);
+		}
+		
+		std::string::const_iterator axisEnd() const {
+			return text.end();
+		}
+	};
+	
+	/**
+	 * A copy of the rendered buffer together with everything needed to encode it,
+	 * so that it can be printed while the plot is already working on the next frame.
+	 */
+	struct Frame {
+		int w = 0, h = 0;
+		bool invertedY = false;
+		Point topLeft;
+		double dx = 0, dy = 0;
+		std::string yFormat, xFormat;
+		std::vector<Cell> cells;
+		mutable std::shared_ptr<const Labels> labels;
+		
+		/**
+		 * Encodes the frame into terminal output, exactly as Plot::print() would.
+		 * @param out The string to which the output is appended.
+		 */
+		void encode(std::string &out) const {
+			Plot::encode(cells.data(), w, h, invertedY, axes(), out);
+		}
+		
+		/**
+		 * Encodes only the cells and axis labels that changed since the previous
+		 * frame, addressing them with cursor movements relative to the top-left
+		 * corner of the terminal. When the size or the orientation differ, the
+		 * whole frame is encoded instead, starting from the top-left corner.
+		 * 
+		 * @param prev The frame that is currently displayed.
+		 * @param out The string to which the output is appended.
+		 */
+		void encodeDiff(const Frame &prev, std::string &out) const {
+			if(prev.w != w || prev.h != h || prev.invertedY != invertedY || 
+					prev.cells.size() != cells.size()) {
+				out += "\x1b[H";
+				encode(out);
+				return;
+			}
+			Plot::encodeDiff(prev.cells.data(), cells.data(), w, h, invertedY, 
+							 &prev.axes(), axes(), out);
+		}
+		
+		/**
+		 * @return The axis labels of the frame.
+		 */
+		const Labels &axes() const {
+			return labelsFor(labels, w, h, topLeft, dx, dy, yFormat, xFormat);
+		}
+	};
+	
 	int w = 10, h = 10;
 	Cell *printBuf = nullptr;
 	int8_t background = BLACK;
@@ -50,12 +502,18 @@ public:
 	double dx, dy;
 	double minX = std::numeric_limits<typeof(minX)>::infinity(),
 		maxX = -minX, minY = minX, maxY = -minX;
+	double rangeLow = 0, rangeHigh = 100;
+	QuantileSketch xQuantiles, yQuantiles;
 	
 	std::unordered_map<Cell, std::vector<Point>, CellHash> points;
 	std::unordered_map<Cell, std::vector<Line>, CellHash> lines;
+	std::vector<Series*> series;
 	
 	std::string yFormat = "", xFormat = "";
 	
+private:
+	mutable std::shared_ptr<const Labels> labels;
+	
 public:
 	Plot() = default;
 	
@@ -139,6 +597,22 @@ public:
 		clearPlot();
 	}
 	
+	/**
+	 * Makes the automatic drawing range ignore outliers.
+	 * Instead of the smallest and largest coordinates, the range spans the given
+	 * percentiles of the coordinates, estimated while the data is added.
+	 * Where the percentiles coincide, the extremes are used instead.
+	 * Attached series still extend the range by their whole bounds.
+	 * Calling without arguments restores the full range.
+	 * 
+	 * @param low The percentile at the left and top edge, e.g. 1.
+	 * @param high The percentile at the right and bottom edge, e.g. 99.
+	 */
+	void setAutoRangePercentiles(double low = 0, double high = 100) {
+		rangeLow = low;
+		rangeHigh = high;
+	}
+	
 	/**
 	 * Sets the background color of the plot.
 	 * 
@@ -159,6 +633,8 @@ public:
 		maxX = -minX;
 		maxY = -minX;
 		
+		xQuantiles.clear();
+		yQuantiles.clear();
 		points.clear();
 		lines.clear();
 	}
@@ -166,12 +642,16 @@ public:
 	/**
 	 * Adds a point to the plot.
 	 * When the drawing range is set, the point can also be drawn in the buffer.
+	 * Points with a NaN or infinite coordinate are ignored.
 	 * @param x The X-coordinate of the point.
 	 * @param y The Y-coordinate of the point.
 	 * @param color The color of the point, defaulting to WHITE.
 	 * @param character The character to be used for drawing the point, by default, is the Unicode square/block character.
 	 */
 	void point(double x, double y, int8_t color = WHITE, char character = '\0') {
+		if(!finite(x) || !finite(y))
+			return;
+		
 		Point p = {x, y};
 		points[{character, color}].push_back(p);
 		
@@ -184,6 +664,7 @@ public:
 	/**
 	 * Adds a line to the plot.
 	 * When the drawing range is set, the line can also be drawn in the buffer.
+	 * Lines with a NaN or infinite coordinate are ignored.
 	 * @param x1 The X-coordinate of the starting point of the line.
 	 * @param y1 The Y-coordinate of the starting point of the line.
 	 * @param x2 The X-coordinate of the ending point of the line.
@@ -193,6 +674,9 @@ public:
 	 */
 	void line(double x1, double y1, double x2, double y2, int8_t color = WHITE, 
 			  char character = '\0') {
+		if(!finite(x1) || !finite(y1) || !finite(x2) || !finite(y2))
+			return;
+		
 		Line l = {{x1, y1}, {x2, y2}};
 		lines[{character, color}].push_back(l);
 		
@@ -205,29 +689,342 @@ public:
 	}
 	
 	/**
-	 * Renders the plot to the buffer.
+	 * Adds many points to the plot at once.
+	 * Points with a NaN or infinite coordinate are dropped.
+	 * 
+	 * @param xs The X-coordinates of the points.
+	 * @param ys The Y-coordinates of the points.
+	 * @param n The number of points.
+	 * @param color The color of the points, defaulting to WHITE.
+	 * @param character The character to be used for drawing the points, by default, is the Unicode square/block character.
+	 */
+	void scatter(const double *xs, const double *ys, std::size_t n, int8_t color = WHITE,
+				 char character = '\0') {
+		std::vector<unsigned char> ok(n);
+		finiteMask(xs, ys, n, ok.data());
+		
+		std::vector<Point> &v = points[{character, color}];
+		const std::size_t first = v.size();
+		for(std::size_t i = 0; i < n; i++)
+			if(ok[i])
+				v.push_back({xs[i], ys[i]});
+		
+		for(std::size_t i = first; i < v.size(); i++) {
+			if(range)
+				printPoint(v[i], color, character);
+			else
+				updateXYMinMax(v[i]);
+		}
+	}
+	
+	/**
+	 * Adds lines connecting consecutive points.
+	 * A point with a NaN or infinite coordinate breaks the strip: no line is
+	 * drawn to or from it.
+	 * 
+	 * @param xs The X-coordinates of the points.
+	 * @param ys The Y-coordinates of the points.
+	 * @param n The number of points.
+	 * @param color The color of the lines, defaulting to WHITE.
+	 * @param character The character to be used for drawing the lines, by default, is the Unicode square/block character.
+	 */
+	void lineStrip(const double *xs, const double *ys, std::size_t n, int8_t color = WHITE,
+				   char character = '\0') {
+		std::vector<unsigned char> ok(n);
+		finiteMask(xs, ys, n, ok.data());
+		
+		std::vector<Line> &v = lines[{character, color}];
+		const std::size_t first = v.size();
+		for(std::size_t i = 1; i < n; i++)
+			if(ok[i-1] & ok[i])
+				v.push_back({{xs[i-1], ys[i-1]}, {xs[i], ys[i]}});
+		
+		for(std::size_t i = first; i < v.size(); i++) {
+			if(range)
+				printLine(v[i], color, character);
+			else {
+				updateXYMinMax(v[i].a);
+				updateXYMinMax(v[i].b);
+			}
+		}
+	}
+	
+	/**
+	 * Draws a matrix of values over the whole plot area, each sub-pixel (half of
+	 * a character) colored by the values of the matrix elements it covers.
+	 * The image is written directly into the buffer and is not stored, so it
+	 * should be drawn after render() or before the data it should lie under
+	 * is added with a drawing range set. NaN and infinite elements are skipped.
+	 * 
+	 * @param data The first element of the matrix, stored row by row.
+	 * @param rows The number of rows, drawn from the top of the plot.
+	 * @param cols The number of columns, drawn from the left of the plot.
+	 * @param stride The distance between the beginnings of rows, in elements.
+	 * @param map Colors of the values. Without a range, the range of the pooled values is used.
+	 * @param pooling Whether the average or the maximum of the covered elements is used.
 	 */
-	void render() {
-		if(!range) {
-			dx = maxX-minX;
-			dy = maxY-minY;
-			topLeft = {minX, minY};
+	void image(const double *data, int rows, int cols, std::size_t stride, 
+			   const Colormap &map = Colormap(), Pooling pooling = AVERAGE) {
+		const int H = h*2;
+		if(rows <= 0 || cols <= 0 || map.colors.empty())
+			return;
+		
+		std::vector<double> pooled(w*H), sum(cols);
+		std::vector<int> count(cols);
+		double low = std::numeric_limits<double>::infinity(), high = -low;
+		const double empty = -std::numeric_limits<double>::infinity();
+		
+		for(int ty = 0; ty < H; ty++) {
+			const int r1 = static_cast<long long>(ty)*rows/H;
+			const int r2 = std::max(r1+1, static_cast<int>(static_cast<long long>(ty+1)*rows/H));
+			
+			// Reduces the covered rows column by column, in loops without
+			// branches.
+			std::fill(sum.begin(), sum.end(), pooling == AVERAGE ? 0 : empty);
+			std::fill(count.begin(), count.end(), 0);
+			for(int r = r1; r < r2; r++) {
+				const double *row = data+r*stride;
+				if(pooling == AVERAGE)
+					for(int c = 0; c < cols; c++) {
+						const bool ok = finite(row[c]);
+						sum[c] += ok ? row[c] : 0;
+						count[c] += ok;
+					}
+				else
+					for(int c = 0; c < cols; c++) {
+						const bool ok = finite(row[c]);
+						sum[c] = ok && row[c] > sum[c] ? row[c] : sum[c];
+						count[c] += ok;
+					}
+			}
+			
+			for(int tx = 0; tx < w; tx++) {
+				const int c1 = static_cast<long long>(tx)*cols/w;
+				const int c2 = std::max(c1+1, static_cast<int>(static_cast<long long>(tx+1)*cols/w));
+				double v = pooling == AVERAGE ? 0 : empty;
+				int n = 0;
+				for(int c = c1; c < c2; c++) {
+					v = pooling == AVERAGE ? v+sum[c] : std::max(v, sum[c]);
+					n += count[c];
+				}
+				
+				if(n == 0)
+					v = std::numeric_limits<double>::quiet_NaN();
+				else if(pooling == AVERAGE)
+					v /= n;
+				
+				pooled[ty*w+tx] = v;
+				if(n) {
+					low = std::min(low, v);
+					high = std::max(high, v);
+				}
+			}
+		}
+		
+		if(!map.autoRange()) {
+			low = map.low;
+			high = map.high;
 		}
 		
-		for(const auto &c : lines)
-			for(const auto &l : c.second)
-				printLine(l, c.first.co, c.first.ch);
+		for(int ty = 0; ty < H; ty++)
+			for(int tx = 0; tx < w; tx++) {
+				const double v = pooled[ty*w+tx];
+				if(v == v)
+					setCell(tx, ty, low == high ? map.colors.back() : map.color(v, low, high), BLOCK);
+			}
+	}
+	
+	/**
+	 * Draws contour lines of a field sampled on a regular grid (marching squares).
+	 * All levels are traced in one pass over the grid, which is split into
+	 * blocks of rows processed in parallel; the resulting segments go straight
+	 * to the rasterizer and are not stored, so the drawing range must be set.
+	 * Grid cells with a NaN or infinite corner are skipped.
+	 * 
+	 * @param data The first value of the grid, stored row by row.
+	 * @param rows The number of rows of the grid, at least 2.
+	 * @param cols The number of columns of the grid, at least 2.
+	 * @param stride The distance between the beginnings of rows, in values.
+	 * @param x1 The X-coordinate of the first column.
+	 * @param y1 The Y-coordinate of the first row.
+	 * @param x2 The X-coordinate of the last column.
+	 * @param y2 The Y-coordinate of the last row.
+	 * @param levels The values at which contour lines are drawn.
+	 * @param map Colors of the levels. Without a range, the range of the levels is used.
+	 * @param character The character to be used for drawing the lines, by default, is the Unicode square/block character.
+	 */
+	void contour(const double *data, int rows, int cols, std::size_t stride,
+				 double x1, double y1, double x2, double y2, 
+				 const std::vector<double> &levels, const Colormap &map = Colormap(),
+				 char character = '\0') {
+		if(!range || rows < 2 || cols < 2 || levels.empty() || map.colors.empty())
+			return;
+		
+		struct Segment {
+			Line l;
+			int8_t color;
+		};
+		
+		std::vector<int8_t> colors;
+		const double low = map.autoRange() ? *std::min_element(levels.begin(), levels.end()) : map.low;
+		const double high = map.autoRange() ? *std::max_element(levels.begin(), levels.end()) : map.high;
+		for(double l : levels)
+			colors.push_back(low == high ? map.colors.back() : map.color(l, low, high));
+		
+		const double sx = (x2-x1)/(cols-1), sy = (y2-y1)/(rows-1);
+		// Segment ends of each case, as pairs of edges: 0 top, 1 right, 2 bottom, 3 left.
+		// Saddles (5 and 10) are listed for a center below the level and
+		// swapped when it is above.
+		static const signed char cases[16][4] = {
+			{-1}, {3, 0, -1}, {0, 1, -1}, {3, 1, -1}, {1, 2, -1}, {3, 0, 1, 2}, {0, 2, -1}, {3, 2, -1},
+			{2, 3, -1}, {0, 2, -1}, {0, 1, 2, 3}, {1, 2, -1}, {1, 3, -1}, {0, 1, -1}, {3, 0, -1}, {-1}
+		};
+		
+		auto trace = [&](int from, int to, std::vector<Segment> &out) {
+			for(int r = from; r < to; r++) {
+				const double *a = data+r*stride, *b = a+stride;
+				for(int c = 0; c+1 < cols; c++) {
+					const double v[4] = {a[c], a[c+1], b[c+1], b[c]};
+					if(!finite(v[0]+v[1]+v[2]+v[3]))
+						continue;
+					
+					for(std::size_t i = 0; i < levels.size(); i++) {
+						const double l = levels[i];
+						const int k = (v[0] > l)|(v[1] > l)<<1|(v[2] > l)<<2|(v[3] > l)<<3;
+						if(k == 0 || k == 15)
+							continue;
+						
+						signed char e[4];
+						std::copy(cases[k], cases[k]+4, e);
+						if((k == 5 || k == 10) && (v[0]+v[1]+v[2]+v[3])/4 > l) {
+							std::swap(e[1], e[3]);
+						}
+						
+						for(int j = 0; j < 4 && e[j] >= 0; j += 2) {
+							Point p[2];
+							for(int m = 0; m < 2; m++) {
+								double gx = c, gy = r;
+								switch(e[j+m]) {
+								case 0: gx += (l-v[0])/(v[1]-v[0]); break;
+								case 1: gx += 1; gy += (l-v[1])/(v[2]-v[1]); break;
+								case 2: gy += 1; gx += (l-v[3])/(v[2]-v[3]); break;
+								case 3: gy += (l-v[0])/(v[3]-v[0]); break;
+								}
+								p[m] = {x1+gx*sx, y1+gy*sy};
+							}
+							out.push_back({{p[0], p[1]}, colors[i]});
+						}
+					}
+				}
+			}
+		};
+		
+		const std::size_t work = static_cast<std::size_t>(rows)*cols*levels.size();
+		const int threads = work < (1<<16) ? 1 : std::min<int>(rows-1, 
+			std::max(1u, std::thread::hardware_concurrency()));
+		std::vector<std::vector<Segment>> segments(threads);
+		std::vector<std::thread> workers;
+		for(int t = 0; t < threads; t++) {
+			const int from = static_cast<long long>(rows-1)*t/threads;
+			const int to = static_cast<long long>(rows-1)*(t+1)/threads;
+			if(t+1 < threads)
+				workers.emplace_back(trace, from, to, std::ref(segments[t]));
+			else
+				trace(from, to, segments[t]);
+		}
+		for(std::thread &t : workers)
+			t.join();
 		
-		for(const auto &c : points)
-			for(const auto &p : c.second)
-				printPoint(p, c.first.co, c.first.ch);
+		for(const auto &block : segments)
+			for(const Segment &s : block)
+				printLine(s.l, s.color, character);
 	}
 	
+	/**
+	 * Attaches a series, which will be drawn by every render() call.
+	 * The series keeps its own data and must outlive the attachment.
+	 * Series are not affected by clearData().
+	 * @param s The series to attach.
+	 */
+	void attach(Series &s) {
+		series.push_back(&s);
+	}
+	
+	/**
+	 * Detaches a series attached with attach().
+	 * @param s The series to detach.
+	 */
+	void detach(Series &s) {
+		for(auto it = series.begin(); it != series.end(); it++)
+			if(*it == &s) {
+				series.erase(it);
+				break;
+			}
+	}
+	
+	/**
+	 * Renders the plot to the buffer.
+	 */
+	void render();
+	
 	/**
 	 * Prints the buffered plot to stdout.
 	 */
-	void print() {
-		int8_t last;
+	void print() const {
+		std::string out;
+		encode(out);
+		fwrite(out.data(), 1, out.size(), stdout);
+	}
+	
+	/**
+	 * Encodes the buffered plot into terminal output without writing it anywhere.
+	 * @param out The string to which the output is appended.
+	 */
+	void encode(std::string &out) const {
+		encode(printBuf, w, h, invertedY, 
+			   labelsFor(labels, w, h, topLeft, dx, dy, yFormat, xFormat), out);
+	}
+	
+	/**
+	 * Copies the buffered plot into a frame, reusing the frame's memory.
+	 * @param f The frame to overwrite.
+	 */
+	void snapshot(Frame &f) const {
+		f.w = w;
+		f.h = h;
+		f.invertedY = invertedY;
+		f.topLeft = topLeft;
+		f.dx = dx;
+		f.dy = dy;
+		f.yFormat = yFormat;
+		f.xFormat = xFormat;
+		f.cells.assign(printBuf, printBuf+w*h);
+		labelsFor(labels, w, h, topLeft, dx, dy, yFormat, xFormat);
+		f.labels = labels;
+	}
+
+private:
+	static void appendf(std::string &out, const char *format, ...) {
+		char buf[64];
+		va_list args, copy;
+		va_start(args, format);
+		va_copy(copy, args);
+		int n = vsnprintf(buf, sizeof(buf), format, args);
+		va_end(args);
+		
+		if(n >= static_cast<int>(sizeof(buf))) {
+			std::size_t at = out.size();
+			out.resize(at+n+1);
+			vsnprintf(&out[at], n+1, format, copy);
+			out.resize(at+n);
+		}
+		else if(n > 0)
+			out.append(buf, n);
+		va_end(copy);
+	}
+	
+	static void encode(const Cell *buf, int w, int h, bool invertedY, 
+					   const Labels &labels, std::string &out) {
 		int startY = 0, endY = h, step = 1;
 		
 		if(invertedY) {
@@ -237,61 +1034,175 @@ public:
 		}
 		
 		for(int y = startY; y != endY; y += step) {
-			Cell *c = printBuf+y*w;
-			for(int x = 0; x < w; x++, c++) {
-				if(last != c->co || x == 0) {
-					printf("\x1b[%d%d;%d%dm", c->co&0x08?9:3, c->co&0x07, 
-						   c->co&0x80?10:4, c->co>>4&0x07);
-					last = c->co;
-				}
-				
-				if(c->ch == BLOCK)
-					printf("\u2580");
-				else
-					putchar(c->ch);
-			}
+			encodeRun(buf+y*w, w, out);
+			out.append(labels.rowBegin(y), labels.rowEnd(y));
+			out += '\n';
+		}
+		out += "\x1b[0m";
+		out.append(labels.axisBegin(), labels.axisEnd());
+	}
+	
+	static const Labels &labelsFor(std::shared_ptr<const Labels> &cache, int w, int h,
+								   const Point &topLeft, double dx, double dy,
+								   const std::string &yFormat, const std::string &xFormat) {
+		const Labels *l = cache.get();
+		if(l != nullptr && l->w == w && l->h == h && l->topLeft.x == topLeft.x &&
+				l->topLeft.y == topLeft.y && l->dx == dx && l->dy == dy &&
+				l->yFormat == yFormat && l->xFormat == xFormat)
+			return *l;
+		
+		std::shared_ptr<Labels> n(new Labels{w, h, topLeft, dx, dy, yFormat, xFormat, "", {}});
+		for(int y = 0; y < h; y++) {
 			if(!yFormat.empty()) {
-				printf("\x1b[0m");
-				printf(yFormat.c_str(), topLeft.y+y*dy/h);
+				n->text += "\x1b[0m";
+				appendf(n->text, yFormat.c_str(), topLeft.y+y*dy/h);
 			}
-			putchar('\n');
+			n->ends.push_back(n->text.size());
 		}
-		printf("\x1b[0m");
 		if(!xFormat.empty()) {
 			for(int x = 0; x < w;) {
-				putchar('|');
-				x += printf(xFormat.c_str(), topLeft.x+x*dx/w)+1;
+				n->text += '|';
+				std::size_t at = n->text.size();
+				appendf(n->text, xFormat.c_str(), topLeft.x+x*dx/w);
+				x += n->text.size()-at+1;
 			}
-			putchar('\n');
+			n->text += '\n';
 		}
-	}
-
-private:
-	void clearPlot() {
-		if(printBuf == nullptr)
-			return;
 		
-		for(Cell *it = printBuf, *end = it+w*h; it < end; it++)
-			*it = {EMPTY, static_cast<int8_t>(background<<4|background)};
+		cache = n;
+		return *n;
 	}
 	
-	void updateXYMinMax(const Point &p) {
-		if(minX > p.x) minX = p.x;
-		if(minY > p.y) minY = p.y;
-		if(maxX < p.x) maxX = p.x;
-		if(maxY < p.y) maxY = p.y;
+	static void encodeRun(const Cell *c, int n, std::string &out) {
+		int8_t last = 0;
+		for(int x = 0; x < n; x++, c++) {
+			if(last != c->co || x == 0) {
+				appendf(out, "\x1b[%d%d;%d%dm", c->co&0x08?9:3, c->co&0x07, 
+						c->co&0x80?10:4, c->co>>4&0x07);
+				last = c->co;
+			}
+			
+			if(c->ch == BLOCK)
+				out += "\u2580";
+			else
+				out += c->ch;
+		}
 	}
 	
-	void setCell(int x, int y, int8_t color, char character) {
-		if(x < 0 || x >= w || y < 0 || y >= h*2)
-			return;
+	static bool sameText(std::string::const_iterator a1, std::string::const_iterator a2,
+						 std::string::const_iterator b1, std::string::const_iterator b2) {
+		return a2-a1 == b2-b1 && std::equal(a1, a2, b1);
+	}
+	
+	// Without previous labels, all Y axis labels are written.
+	static void encodeDiff(const Cell *prev, const Cell *cur, int w, int h, 
+						   bool invertedY, const Labels *prevLabels, 
+						   const Labels &labels, std::string &out) {
+		// Unchanged cells shorter than a cursor jump are simply rewritten.
+		const int gap = 8;
 		
-		Cell &c = printBuf[x+(y/2)*w];
-		if(character == '\0') {
-			if(c.ch == EMPTY)
-				c.ch = BLOCK;
+		for(int row = 0; row < h; row++) {
+			const int y = invertedY ? h-1-row : row;
+			const Cell *p = prev+y*w, *c = cur+y*w;
 			
-			if(invertedY)
+			for(int x = 0; x < w;) {
+				if(p[x] == c[x]) {
+					x++;
+					continue;
+				}
+				
+				int end = x+1, same = 0;
+				for(int i = end; i < w && same < gap; i++) {
+					if(p[i] == c[i])
+						same++;
+					else {
+						same = 0;
+						end = i+1;
+					}
+				}
+				
+				appendf(out, "\x1b[%d;%dH", row+1, x+1);
+				encodeRun(c+x, end-x, out);
+				x = end;
+			}
+			
+			if(prevLabels == nullptr || !sameText(labels.rowBegin(y), labels.rowEnd(y),
+					prevLabels->rowBegin(y), prevLabels->rowEnd(y))) {
+				appendf(out, "\x1b[%d;%dH", row+1, w+1);
+				out.append(labels.rowBegin(y), labels.rowEnd(y));
+				out += "\x1b[0m\x1b[K";
+			}
+		}
+		
+		const bool xAxis = labels.axisBegin() != labels.axisEnd();
+		if(prevLabels == nullptr || !sameText(labels.axisBegin(), labels.axisEnd(),
+				prevLabels->axisBegin(), prevLabels->axisEnd())) {
+			appendf(out, "\x1b[0m\x1b[%d;1H", h+1);
+			out.append(labels.axisBegin(), labels.axisEnd()-xAxis);
+			out += "\x1b[K";
+		}
+		appendf(out, "\x1b[0m\x1b[%d;1H", h+1+xAxis);
+	}
+	
+	void recycleData() {
+		clearPlot();
+		
+		minX = std::numeric_limits<typeof(minX)>::infinity();
+		minY = minX;
+		maxX = -minX;
+		maxY = -minX;
+		
+		xQuantiles.clear();
+		yQuantiles.clear();
+		for(auto &c : points)
+			c.second.clear();
+		for(auto &c : lines)
+			c.second.clear();
+	}
+	
+	void clearPlot() {
+		if(printBuf == nullptr)
+			return;
+		
+		for(Cell *it = printBuf, *end = it+w*h; it < end; it++)
+			*it = {EMPTY, static_cast<int8_t>(background<<4|background)};
+	}
+	
+	// Loops over the data, like this one, are written without branches or
+	// library calls so that compilers can vectorize them. Whether they do
+	// depends on the compiler, the optimization level and the target: GCC 12
+	// vectorizes this one only for targets with AVX2 (-march=x86-64-v3).
+	static void finiteMask(const double *xs, const double *ys, std::size_t n, 
+						   unsigned char *ok) {
+		for(std::size_t i = 0; i < n; i++)
+			ok[i] = finite(xs[i]) & finite(ys[i]);
+	}
+	
+	bool robustRange() const {
+		return rangeLow > 0 || rangeHigh < 100;
+	}
+	
+	void updateXYMinMax(const Point &p) {
+		if(minX > p.x) minX = p.x;
+		if(minY > p.y) minY = p.y;
+		if(maxX < p.x) maxX = p.x;
+		if(maxY < p.y) maxY = p.y;
+		
+		// Fed even without percentiles, so that they can be enabled any time.
+		xQuantiles.add(p.x);
+		yQuantiles.add(p.y);
+	}
+	
+	void setCell(int x, int y, int8_t color, char character) {
+		if(x < 0 || x >= w || y < 0 || y >= h*2)
+			return;
+		
+		Cell &c = printBuf[x+(y/2)*w];
+		if(character == '\0') {
+			if(c.ch == EMPTY)
+				c.ch = BLOCK;
+			
+			if(invertedY)
 				y++;
 			c.co = y%2 ? c.co&0x0f|color<<4 : c.co&0xf0|color;
 		}
@@ -307,15 +1218,65 @@ private:
 		}
 	}
 	
+	// Clips a line given in sub-pixels to the buffer (Liang-Barsky), so that
+	// far away ends do not make the rasterizer walk outside the plot.
+	// Lines ending near the buffer are kept as they are.
+	bool clipLine(double &x1, double &y1, double &x2, double &y2) const {
+		const double W = w, H = h*2;
+		if(!finite(x1+y1+x2+y2))
+			return false;
+		if(x1 >= -W && x1 <= 2*W && x2 >= -W && x2 <= 2*W &&
+				y1 >= -H && y1 <= 2*H && y2 >= -H && y2 <= 2*H)
+			return true;
+		
+		const double ex = x2-x1, ey = y2-y1;
+		const double p[4] = {-ex, ex, -ey, ey};
+		const double q[4] = {x1+1, W-x1, y1+1, H-y1};
+		double t1 = 0, t2 = 1;
+		for(int i = 0; i < 4; i++) {
+			if(p[i] == 0) {
+				if(q[i] < 0)
+					return false;
+			}
+			else if(p[i] < 0)
+				t1 = std::max(t1, q[i]/p[i]);
+			else
+				t2 = std::min(t2, q[i]/p[i]);
+		}
+		if(!(t1 <= t2))
+			return false;
+		
+		x2 = x1+t2*ex;
+		y2 = y1+t2*ey;
+		x1 += t1*ex;
+		y1 += t1*ey;
+		return true;
+	}
+	
+	double toX(double x) const {
+		return (x-topLeft.x)*w/dx;
+	}
+	
+	double toY(double y) const {
+		return (y-topLeft.y)*h*2/dy;
+	}
+	
 	void printPoint(const Point &p, int8_t color, char character) {
-		setCell((p.x-topLeft.x)*w/dx, (p.y-topLeft.y)*h*2/dy, color, character);
+		const double x = toX(p.x), y = toY(p.y);
+		if(x > -1 && x < w && y > -1 && y < h*2)
+			setCell(x, y, color, character);
 	}
 	
 	void printLine(const Line &l, int8_t color, char character) {
-		int x1 = (l.a.x-topLeft.x)*w/dx;
-		int y1 = (l.a.y-topLeft.y)*h*2/dy;
-		const int x2 = (l.b.x-topLeft.x)*w/dx;
-		const int y2 = (l.b.y-topLeft.y)*h*2/dy;
+		double fx1 = toX(l.a.x), fy1 = toY(l.a.y);
+		double fx2 = toX(l.b.x), fy2 = toY(l.b.y);
+		if(!clipLine(fx1, fy1, fx2, fy2))
+			return;
+		
+		int x1 = fx1;
+		int y1 = fy1;
+		const int x2 = fx2;
+		const int y2 = fy2;
 		const int dx = abs(x2-x1);
 		const int dy = abs(y2-y1);
 		const int sx = (x1 < x2) ? 1 : -1;
@@ -338,6 +1299,3723 @@ private:
 			}
 		}
 	}
+	
+	// Fills the sub-pixels of column x between rows y1 and y2 (in sub-pixels).
+	void printColumn(int x, double y1, double y2, int8_t color, char character) {
+		if(y1 > y2)
+			std::swap(y1, y2);
+		if(x < 0 || x >= w || !(y2 > -1 && y1 < h*2))
+			return;
+		
+		const int from = std::max(y1, 0.0), to = std::min(y2, h*2-1.0);
+		for(int y = from; y <= to; y++)
+			setCell(x, y, color, character);
+	}
+	
+	void printRow(int y, double x1, double x2, int8_t color, char character) {
+		if(x1 > x2)
+			std::swap(x1, x2);
+		if(y < 0 || y >= h*2 || !(x2 > -1 && x1 < w))
+			return;
+		
+		const int from = std::max(x1, 0.0), to = std::min(x2, w-1.0);
+		for(int x = from; x <= to; x++)
+			setCell(x, y, color, character);
+	}
+	
+	// Fills the area between two segments sharing their X-coordinates,
+	// one vertical span per column.
+	void printBand(double x1, double lo1, double hi1, double x2, double lo2, double hi2,
+				   int8_t color, char character) {
+		double fx1 = toX(x1), fx2 = toX(x2);
+		if(fx1 > fx2) {
+			std::swap(fx1, fx2);
+			std::swap(lo1, lo2);
+			std::swap(hi1, hi2);
+		}
+		if(!finite(fx1+fx2+lo1+hi1+lo2+hi2) || fx2 < 0 || fx1 >= w)
+			return;
+		
+		const int from = std::max(fx1, 0.0), to = std::min(fx2, w-1.0);
+		for(int x = from; x <= to; x++) {
+			double t = fx2 > fx1 ? (x+0.5-fx1)/(fx2-fx1) : 0.5;
+			t = std::min(std::max(t, 0.0), 1.0);
+			printColumn(x, toY(lo1+(lo2-lo1)*t), toY(hi1+(hi2-hi1)*t), color, character);
+		}
+	}
+};
+
+/**
+ * Base of series which keep their own data and draw it only when the plot is
+ * rendered, after the drawing range is known. This lets a series aggregate
+ * or derive its data at the resolution of the plot instead of storing
+ * primitives in it.
+ */
+class Series {
+public:
+	virtual ~Series() = default;
+	
+	/**
+	 * Extends the bounds by the data of the series.
+	 * Used for the automatic drawing range; by default the series does not
+	 * take part in it.
+	 */
+	virtual void bounds(double &minX, double &minY, double &maxX, double &maxY) const {
+		(void)minX, (void)minY, (void)maxX, (void)maxY;
+	}
+	
+	/**
+	 * Draws the series into the buffer of the plot, in its drawing range.
+	 * @param p The plot being rendered.
+	 */
+	virtual void draw(Plot &p) = 0;
+	
+protected:
+	static void drawPoint(Plot &p, const Plot::Point &a, int8_t color, char character) {
+		p.printPoint(a, color, character);
+	}
+	
+	static void drawLine(Plot &p, const Plot::Line &l, int8_t color, char character) {
+		p.printLine(l, color, character);
+	}
+	
+	static void drawBand(Plot &p, double x1, double lo1, double hi1, 
+						 double x2, double lo2, double hi2, int8_t color, char character) {
+		p.printBand(x1, lo1, hi1, x2, lo2, hi2, color, character);
+	}
+	
+	// Horizontal line from (x1, y) to (x2, y), one span of sub-pixels.
+	static void drawHorizontal(Plot &p, double x1, double x2, double y, int8_t color, char character) {
+		const double fy = p.toY(y);
+		if(fy > -1 && fy < p.h*2)
+			p.printRow(fy, p.toX(x1), p.toX(x2), color, character);
+	}
+	
+	// Vertical line from (x, y1) to (x, y2), one span of sub-pixels.
+	static void drawVertical(Plot &p, double x, double y1, double y2, int8_t color, char character) {
+		const double fx = p.toX(x);
+		if(fx > -1 && fx < p.w)
+			p.printColumn(fx, p.toY(y1), p.toY(y2), color, character);
+	}
+	
+	// The X-coordinates of the left and right edges of the drawing range.
+	static void visibleX(const Plot &p, double &x1, double &x2) {
+		x1 = std::min(p.topLeft.x, p.topLeft.x+p.dx);
+		x2 = std::max(p.topLeft.x, p.topLeft.x+p.dx);
+	}
+};
+
+inline void Plot::render() {
+	if(!range) {
+		double x1 = minX, y1 = minY, x2 = maxX, y2 = maxY;
+		if(robustRange() && xQuantiles.count() > 0) {
+			// Where the percentiles coincide, the extremes are kept.
+			const double qx1 = xQuantiles.quantile(rangeLow/100), qx2 = xQuantiles.quantile(rangeHigh/100);
+			const double qy1 = yQuantiles.quantile(rangeLow/100), qy2 = yQuantiles.quantile(rangeHigh/100);
+			if(qx2 > qx1) {
+				x1 = qx1;
+				x2 = qx2;
+			}
+			if(qy2 > qy1) {
+				y1 = qy1;
+				y2 = qy2;
+			}
+		}
+		for(const Series *s : series)
+			s->bounds(x1, y1, x2, y2);
+		
+		dx = x2-x1;
+		dy = y2-y1;
+		topLeft = {x1, y1};
+	}
+	
+	for(Series *s : series)
+		s->draw(*this);
+	
+	for(const auto &c : lines)
+		for(const auto &l : c.second)
+			printLine(l, c.first.co, c.first.ch);
+	
+	for(const auto &c : points)
+		for(const auto &p : c.second)
+			printPoint(p, c.first.co, c.first.ch);
+}
+
+/**
+ * Summarizes samples in buckets of equal width along the X axis and draws,
+ * for each bucket, the mean plus/minus one standard deviation as a filled band
+ * together with lines through the medians and the 99th percentiles.
+ * Every sample updates one bucket: its running mean and variance (Welford's
+ * method) and its quantile sketch.
+ */
+class StatsBands : public Series {
+public:
+	int8_t bandColor = DARK_GRAY, medianColor = WHITE, highColor = RED;
+	
+	/**
+	 * @param bucketWidth Width of a bucket in X-coordinates.
+	 * @param maxBuckets The number of newest buckets kept.
+	 */
+	StatsBands(double bucketWidth, std::size_t maxBuckets = 1<<16) : 
+		width(bucketWidth), maxBuckets(std::max<std::size_t>(maxBuckets, 1)) {}
+	
+	/**
+	 * Adds a sample. Samples older than the kept buckets are ignored.
+	 * @param x The X-coordinate of the sample.
+	 * @param y The value of the sample.
+	 */
+	void add(double x, double y) {
+		const double t = std::floor(x/width);
+		if(!(std::abs(t) < 4e18) || !finite(y))
+			return;
+		
+		const long long i = t, max = maxBuckets;
+		if(buckets.empty() || i-first >= max) {
+			// None of the kept buckets would remain.
+			buckets.clear();
+			first = i;
+		}
+		
+		const long long size = buckets.size();
+		if(i < first) {
+			if(first+size-i > max)
+				return;
+			buckets.insert(buckets.begin(), first-i, Bucket());
+			first = i;
+		}
+		else if(i >= first+size) {
+			buckets.resize(i-first+1);
+			if(static_cast<long long>(buckets.size()) > max) {
+				const long long drop = buckets.size()-max;
+				buckets.erase(buckets.begin(), buckets.begin()+drop);
+				first += drop;
+			}
+		}
+		
+		Bucket &b = buckets[i-first];
+		b.n++;
+		const double d = y-b.mean;
+		b.mean += d/b.n;
+		b.m2 += d*(y-b.mean);
+		b.quantiles.add(y);
+		b.dirty = true;
+	}
+	
+	/**
+	 * Removes all samples.
+	 */
+	void clear() {
+		buckets.clear();
+	}
+	
+	void bounds(double &minX, double &minY, double &maxX, double &maxY) const override {
+		for(std::size_t i = 0; i < buckets.size(); i++) {
+			const Bucket &b = buckets[i];
+			if(b.n == 0)
+				continue;
+			
+			b.update();
+			const double x = (first+i+0.5)*width;
+			minX = std::min(minX, x);
+			maxX = std::max(maxX, x);
+			minY = std::min(minY, std::min(b.mean-b.deviation(), b.median));
+			maxY = std::max(maxY, std::max(b.mean+b.deviation(), b.high));
+		}
+	}
+	
+	void draw(Plot &p) override {
+		if(buckets.empty())
+			return;
+		
+		// Only the visible buckets and their neighbours are drawn.
+		const double x1 = std::min(p.topLeft.x, p.topLeft.x+p.dx)/width;
+		const double x2 = std::max(p.topLeft.x, p.topLeft.x+p.dx)/width;
+		const long long last = first+buckets.size()-1;
+		const long long from = std::max<double>(first, std::floor(x1)-1);
+		const long long to = std::min<double>(last, std::floor(x2)+1);
+		
+		for(long long i = from; i <= to; i++) {
+			const Bucket &a = buckets[i-first];
+			if(a.n == 0)
+				continue;
+			
+			a.update();
+			const double xa = (i+0.5)*width;
+			const Bucket *b = i < last ? &buckets[i+1-first] : nullptr;
+			if(b == nullptr || b->n == 0) {
+				if(i == first || buckets[i-1-first].n == 0) {
+					drawBand(p, xa, a.mean-a.deviation(), a.mean+a.deviation(), 
+							 xa, a.mean-a.deviation(), a.mean+a.deviation(), bandColor, '\0');
+					drawPoint(p, {xa, a.median}, medianColor, '\0');
+					drawPoint(p, {xa, a.high}, highColor, '\0');
+				}
+				continue;
+			}
+			
+			b->update();
+			const double xb = xa+width;
+			drawBand(p, xa, a.mean-a.deviation(), a.mean+a.deviation(),
+					 xb, b->mean-b->deviation(), b->mean+b->deviation(), bandColor, '\0');
+			drawLine(p, {{xa, a.median}, {xb, b->median}}, medianColor, '\0');
+			drawLine(p, {{xa, a.high}, {xb, b->high}}, highColor, '\0');
+		}
+	}
+	
+private:
+	struct Bucket {
+		double n = 0, mean = 0, m2 = 0;
+		QuantileSketch quantiles;
+		mutable double median = 0, high = 0;
+		mutable bool dirty = false;
+		
+		double deviation() const {
+			return n > 1 ? std::sqrt(m2/(n-1)) : 0;
+		}
+		
+		void update() const {
+			if(!dirty)
+				return;
+			median = quantiles.quantile(0.5);
+			high = quantiles.quantile(0.99);
+			dirty = false;
+		}
+	};
+	
+	double width;
+	std::size_t maxBuckets;
+	long long first = 0;
+	std::deque<Bucket> buckets;
+};
+
+/**
+ * Aggregates samples into open/high/low/close candles, one per group of
+ * columns of the plot, whatever the drawing range is.
+ * Samples are first collected in buckets of a fixed fine width, and a tree of
+ * merged buckets is kept up to date as they arrive, so a candle covering any
+ * range of buckets is merged from a logarithmic number of nodes. Zooming only
+ * changes which nodes are merged.
+ */
+class Candlesticks : public Series {
+public:
+	int8_t upColor = GREEN, downColor = RED, wickColor = BRIGHT_GRAY;
+	
+	/**
+	 * @param resolution The finest X distance that candles can distinguish.
+	 * @param candleWidth Width of one candle in columns; from 2 columns up,
+	 * the last column is left empty as a gap between candles.
+	 * @param maxBuckets The largest number of buckets of the resolution kept.
+	 * When a newer sample does not fit, the oldest buckets are dropped, at
+	 * least half of them at once.
+	 */
+	Candlesticks(double resolution, int candleWidth = 1, std::size_t maxBuckets = 1<<20) : 
+		resolution(resolution), candleWidth(std::max(candleWidth, 1)), 
+		maxBuckets(std::max<std::size_t>(maxBuckets, 2)) {}
+	
+	/**
+	 * Adds a sample. Samples older than the kept buckets are ignored.
+	 * @param x The X-coordinate (usually time) of the sample.
+	 * @param y The value of the sample.
+	 */
+	void add(double x, double y) {
+		const double t = std::floor(x/resolution);
+		if(!(std::abs(t) < 4e18) || !finite(y))
+			return;
+		
+		const long long i = t, max = maxBuckets;
+		if(tree.empty()) {
+			first = i;
+			tree.resize(1);
+		}
+		
+		const long long last = first+static_cast<long long>(tree[0].size())-1;
+		if(i-first >= max) {
+			const long long start = std::max(i-max+1, first+max/2);
+			if(start > last)
+				tree[0].clear();
+			else
+				tree[0].erase(tree[0].begin(), tree[0].begin()+(start-first));
+			first = start;
+			tree.resize(1);
+			rebuild(0);
+		}
+		else if(i < first) {
+			if(last-i >= max)
+				return;
+			tree[0].insert(tree[0].begin(), first-i, OHLC());
+			first = i;
+			tree.resize(1);
+			rebuild(0);
+		}
+		
+		const std::size_t j = i-first;
+		if(j >= tree[0].size()) {
+			tree[0].resize(j+1);
+			rebuild(tree[0].size()-1);
+		}
+		
+		tree[0][j].add(x, y);
+		update(j);
+	}
+	
+	/**
+	 * Removes all samples.
+	 */
+	void clear() {
+		tree.clear();
+	}
+	
+	void bounds(double &minX, double &minY, double &maxX, double &maxY) const override {
+		if(tree.empty())
+			return;
+		
+		const OHLC &all = query(0, tree[0].size());
+		minX = std::min(minX, all.openX);
+		maxX = std::max(maxX, all.closeX);
+		minY = std::min(minY, all.low);
+		maxY = std::max(maxY, all.high);
+	}
+	
+	void draw(Plot &p) override {
+		if(tree.empty())
+			return;
+		
+		const double columnWidth = p.dx/p.w;
+		const int bodyWidth = candleWidth > 1 ? candleWidth-1 : 1;
+		
+		for(int c = 0; c < p.w; c += candleWidth) {
+			const double x1 = p.topLeft.x+c*columnWidth;
+			const double x2 = x1+candleWidth*columnWidth;
+			const long long a = std::max<double>(std::ceil(x1/resolution)-first, 0);
+			const long long b = std::min<double>(std::ceil(x2/resolution)-first, 
+												 tree[0].size());
+			if(a >= b)
+				continue;
+			
+			const OHLC k = query(a, b);
+			if(k.empty())
+				continue;
+			
+			const int8_t color = k.close >= k.open ? upColor : downColor;
+			drawColumn(p, c+bodyWidth/2, k.low, k.high, wickColor);
+			for(int i = 0; i < bodyWidth; i++)
+				drawColumn(p, c+i, k.open, k.close, color);
+		}
+	}
+	
+private:
+	struct OHLC {
+		double open = 0, high = -std::numeric_limits<double>::infinity(), 
+			low = std::numeric_limits<double>::infinity(), close = 0;
+		double openX = std::numeric_limits<double>::infinity(), closeX = -openX;
+		
+		bool empty() const {
+			return openX > closeX;
+		}
+		
+		void add(double x, double y) {
+			if(x < openX) {
+				openX = x;
+				open = y;
+			}
+			if(x >= closeX) {
+				closeX = x;
+				close = y;
+			}
+			high = std::max(high, y);
+			low = std::min(low, y);
+		}
+		
+		void merge(const OHLC &a) {
+			if(a.openX < openX) {
+				openX = a.openX;
+				open = a.open;
+			}
+			if(a.closeX >= closeX) {
+				closeX = a.closeX;
+				close = a.close;
+			}
+			high = std::max(high, a.high);
+			low = std::min(low, a.low);
+		}
+	};
+	
+	double resolution;
+	int candleWidth;
+	std::size_t maxBuckets;
+	long long first = 0;
+	// tree[k][i] merges the buckets tree[0][i<<k] to tree[0][((i+1)<<k)-1].
+	std::vector<std::vector<OHLC>> tree;
+	
+	void update(std::size_t j) {
+		for(std::size_t k = 1; k < tree.size(); k++) {
+			j >>= 1;
+			OHLC m = tree[k-1][2*j];
+			if(2*j+1 < tree[k-1].size())
+				m.merge(tree[k-1][2*j+1]);
+			tree[k][j] = m;
+		}
+	}
+	
+	// Resizes the levels above the buckets after they grew, recomputing the
+	// nodes from bucket j on.
+	void rebuild(std::size_t j) {
+		for(std::size_t k = 1; tree[k-1].size() > 1; k++) {
+			if(k == tree.size())
+				tree.emplace_back();
+			tree[k].resize((tree[k-1].size()+1)/2);
+			
+			for(std::size_t i = (j >>= 1); i < tree[k].size(); i++) {
+				OHLC m = tree[k-1][2*i];
+				if(2*i+1 < tree[k-1].size())
+					m.merge(tree[k-1][2*i+1]);
+				tree[k][i] = m;
+			}
+		}
+	}
+	
+	OHLC query(std::size_t a, std::size_t b) const {
+		OHLC m;
+		while(a < b) {
+			std::size_t k = 0;
+			while(k+1 < tree.size() && a%(std::size_t(2)<<k) == 0 && 
+					a+(std::size_t(2)<<k) <= b)
+				k++;
+			m.merge(tree[k][a>>k]);
+			a += std::size_t(1)<<k;
+		}
+		return m;
+	}
+	
+	static void drawColumn(Plot &p, int x, double y1, double y2, int8_t color) {
+		const double left = p.topLeft.x+(x+0.5)*p.dx/p.w;
+		drawBand(p, left, y1, y2, left, y1, y2, color, '\0');
+	}
+};
+
+/**
+ * Draws the distribution of groups of values as box plots or error bars.
+ * Quartiles are computed when the plot is rendered, for all new groups at
+ * once, spread over the available cores; each group is partially sorted
+ * with selection only around the needed ranks. Groups larger than a
+ * threshold are summarized by a QuantileSketch when added instead of being
+ * stored.
+ */
+class BoxPlot : public Series {
+public:
+	enum Style {BOX, ERROR_BAR};
+	
+	int8_t boxColor = BLUE, medianColor = WHITE, whiskerColor = BRIGHT_GRAY;
+	
+	/**
+	 * @param style BOX draws a box between the quartiles with a line at the median,
+	 * ERROR_BAR draws only the whiskers with a point at the median.
+	 * @param width Width of the boxes and whisker caps in X-coordinates.
+	 * @param whiskerLow The percentile at which the lower whisker ends.
+	 * @param whiskerHigh The percentile at which the upper whisker ends.
+	 */
+	BoxPlot(Style style = BOX, double width = 0.5, double whiskerLow = 0, 
+			double whiskerHigh = 100) : style(style), width(width), 
+			whiskerLow(whiskerLow), whiskerHigh(whiskerHigh) {}
+	
+	/**
+	 * Sets the number of values from which a group is summarized by a sketch
+	 * instead of being copied, 1 << 22 by default.
+	 * @param n The number of values.
+	 */
+	void setSketchThreshold(std::size_t n) {
+		sketchThreshold = n;
+	}
+	
+	/**
+	 * Adds a group of values. NaN and infinite values are ignored.
+	 * 
+	 * @param x The X-coordinate at which the group is drawn.
+	 * @param values The values of the group.
+	 * @param n The number of values.
+	 */
+	void add(double x, const double *values, std::size_t n) {
+		groups.emplace_back();
+		Group &g = groups.back();
+		g.x = x;
+		
+		if(n >= sketchThreshold) {
+			for(std::size_t i = 0; i < n; i++)
+				if(finite(values[i]))
+					g.sketch.add(values[i]);
+		}
+		else {
+			g.values.reserve(n);
+			for(std::size_t i = 0; i < n; i++)
+				if(finite(values[i]))
+					g.values.push_back(values[i]);
+		}
+	}
+	
+	/**
+	 * Removes all groups.
+	 */
+	void clear() {
+		groups.clear();
+	}
+	
+	void bounds(double &minX, double &minY, double &maxX, double &maxY) const override {
+		compute();
+		for(const Group &g : groups) {
+			if(g.empty)
+				continue;
+			minX = std::min(minX, g.x-width/2);
+			maxX = std::max(maxX, g.x+width/2);
+			minY = std::min(minY, g.q[0]);
+			maxY = std::max(maxY, g.q[4]);
+		}
+	}
+	
+	void draw(Plot &p) override {
+		compute();
+		
+		const double w2 = width/2;
+		for(const Group &g : groups) {
+			if(g.empty)
+				continue;
+			
+			const double x = g.x;
+			drawLine(p, {{x, g.q[0]}, {x, g.q[4]}}, whiskerColor, '\0');
+			drawLine(p, {{x-w2/2, g.q[0]}, {x+w2/2, g.q[0]}}, whiskerColor, '\0');
+			drawLine(p, {{x-w2/2, g.q[4]}, {x+w2/2, g.q[4]}}, whiskerColor, '\0');
+			
+			if(style == BOX) {
+				drawBand(p, x-w2, g.q[1], g.q[3], x+w2, g.q[1], g.q[3], boxColor, '\0');
+				drawLine(p, {{x-w2, g.q[2]}, {x+w2, g.q[2]}}, medianColor, '\0');
+			}
+			else
+				drawPoint(p, {x, g.q[2]}, medianColor, '\0');
+		}
+	}
+	
+private:
+	// The quantiles are computed when first needed, also by bounds(); the
+	// values are reordered while selecting them.
+	struct Group {
+		double x;
+		mutable std::vector<double> values;
+		QuantileSketch sketch;
+		// Lower whisker, first quartile, median, third quartile, upper whisker.
+		mutable double q[5];
+		mutable bool done = false, empty = true;
+	};
+	
+	Style style;
+	double width, whiskerLow, whiskerHigh;
+	std::size_t sketchThreshold = 1<<22;
+	std::deque<Group> groups;
+	mutable std::size_t computed = 0;
+	
+	void compute() const {
+		if(computed == groups.size())
+			return;
+		
+		std::size_t values = 0;
+		for(std::size_t i = computed; i < groups.size(); i++)
+			values += groups[i].values.size();
+		
+		const std::size_t pending = groups.size()-computed;
+		const std::size_t threads = values < (1<<16) ? 1 : 
+			std::min<std::size_t>(pending, std::max(1u, std::thread::hardware_concurrency()));
+		std::atomic<std::size_t> next(computed);
+		auto work = [this, &next]() {
+			for(std::size_t i; (i = next++) < groups.size();)
+				quartiles(groups[i]);
+		};
+		
+		std::vector<std::thread> workers;
+		for(std::size_t t = 1; t < threads; t++)
+			workers.emplace_back(work);
+		work();
+		for(std::thread &t : workers)
+			t.join();
+		
+		computed = groups.size();
+	}
+	
+	void quartiles(const Group &g) const {
+		const double q[5] = {whiskerLow/100, 0.25, 0.5, 0.75, whiskerHigh/100};
+		
+		if(g.values.empty()) {
+			g.empty = g.sketch.count() == 0;
+			for(int i = 0; i < 5 && !g.empty; i++)
+				g.q[i] = g.sketch.quantile(q[i]);
+		}
+		else {
+			// Ranks are selected in increasing order, each selection only
+			// partitioning what lies above the previous one.
+			std::vector<double> &v = g.values;
+			int order[5] = {0, 1, 2, 3, 4};
+			std::sort(order, order+5, [&q](int a, int b) {return q[a] < q[b];});
+			
+			std::size_t from = 0;
+			for(int i : order) {
+				const double r = std::min(std::max(q[i], 0.0), 1.0);
+				const std::size_t k = r*(v.size()-1);
+				if(k >= from) {
+					std::nth_element(v.begin()+from, v.begin()+k, v.end());
+					from = k;
+				}
+				g.q[i] = v[k];
+			}
+			g.empty = false;
+		}
+		g.done = true;
+	}
+};
+
+/**
+ * Points or a line strip colored by a third value of each sample, mapped
+ * through a colormap when drawing. Samples are kept as separate arrays of
+ * coordinates and values, and the colors of all of them are looked up in
+ * one pass.
+ */
+class ColoredSeries : public Series {
+public:
+	enum Style {POINTS, LINES};
+	Colormap map;
+	
+	/**
+	 * @param map The colormap. Without a range, the range of the values is used.
+	 * @param style Whether the samples are drawn as points or joined by lines;
+	 * a line has the color of the mean value of its ends.
+	 * @param character The character to be used for drawing, by default, is the Unicode square/block character.
+	 */
+	ColoredSeries(const Colormap &map = Colormap(), Style style = POINTS, char character = '\0') : 
+		map(map), style(style), character(character) {}
+	
+	/**
+	 * Adds a sample. Samples with a NaN or infinite coordinate are not drawn,
+	 * and break the line strip.
+	 * @param x The X-coordinate of the sample.
+	 * @param y The Y-coordinate of the sample.
+	 * @param v The value giving the color of the sample.
+	 */
+	void add(double x, double y, double v) {
+		xs.push_back(x);
+		ys.push_back(y);
+		vs.push_back(v);
+	}
+	
+	/**
+	 * Adds many samples.
+	 * @param x The X-coordinates of the samples.
+	 * @param y The Y-coordinates of the samples.
+	 * @param v The values giving the colors of the samples.
+	 * @param n The number of samples.
+	 */
+	void add(const double *x, const double *y, const double *v, std::size_t n) {
+		xs.insert(xs.end(), x, x+n);
+		ys.insert(ys.end(), y, y+n);
+		vs.insert(vs.end(), v, v+n);
+	}
+	
+	/**
+	 * Removes all samples.
+	 */
+	void clear() {
+		xs.clear();
+		ys.clear();
+		vs.clear();
+	}
+	
+	void bounds(double &minX, double &minY, double &maxX, double &maxY) const override {
+		for(std::size_t i = 0; i < xs.size(); i++) {
+			if(!finite(xs[i]) || !finite(ys[i]))
+				continue;
+			minX = std::min(minX, xs[i]);
+			maxX = std::max(maxX, xs[i]);
+			minY = std::min(minY, ys[i]);
+			maxY = std::max(maxY, ys[i]);
+		}
+	}
+	
+	void draw(Plot &p) override {
+		const std::size_t n = xs.size();
+		if(n == 0 || map.colors.empty())
+			return;
+		
+		const double *v = vs.data();
+		std::size_t m = n;
+		if(style == LINES) {
+			m = n-1;
+			mean.resize(m);
+			for(std::size_t i = 0; i < m; i++)
+				mean[i] = (vs[i]+vs[i+1])/2;
+			v = mean.data();
+		}
+		
+		double low = map.low, high = map.high;
+		if(map.autoRange()) {
+			low = std::numeric_limits<double>::infinity();
+			high = -low;
+			for(std::size_t i = 0; i < m; i++) {
+				if(finite(v[i])) {
+					low = std::min(low, v[i]);
+					high = std::max(high, v[i]);
+				}
+			}
+			if(!(low < high))
+				high = low+1;
+		}
+		colors.resize(m);
+		map.map(v, colors.data(), m, low, high);
+		
+		if(style == POINTS) {
+			for(std::size_t i = 0; i < n; i++)
+				drawPoint(p, {xs[i], ys[i]}, colors[i], character);
+		}
+		else {
+			for(std::size_t i = 0; i < m; i++) {
+				const Plot::Line l = {{xs[i], ys[i]}, {xs[i+1], ys[i+1]}};
+				if(finite(l.a.x) && finite(l.a.y) && finite(l.b.x) && finite(l.b.y))
+					drawLine(p, l, colors[i], character);
+			}
+		}
+	}
+	
+private:
+	Style style;
+	char character;
+	std::vector<double> xs, ys, vs, mean;
+	std::vector<int8_t> colors;
+};
+
+/**
+ * Two-dimensional histogram of dense scatter data, with rectangular or
+ * hexagonal bins, drawn as a heat map of the counts. Only the counts are
+ * kept. Large batches of samples are counted in parallel, each thread into
+ * its own grid, and the grids are summed afterwards.
+ * Each sub-pixel of the plot takes the color of the bin its center falls in.
+ */
+class Histogram2D : public Series {
+public:
+	enum Shape {RECTANGLE, HEXAGON};
+	Colormap map;
+	
+	/**
+	 * @param x1 The lowest X-coordinate binned.
+	 * @param y1 The lowest Y-coordinate binned.
+	 * @param x2 The highest X-coordinate binned.
+	 * @param y2 The highest Y-coordinate binned.
+	 * @param cols The number of bins along the X axis.
+	 * @param rows The number of bins along the Y axis; hexagons are spaced 
+	 * by the height of a row, and every other row is shifted by half a bin.
+	 * @param shape The shape of the bins.
+	 * @param map The colormap of the counts. Without a range, the colors span
+	 * from one sample to the largest count.
+	 * @param logScale Whether the colors follow the logarithm of the counts.
+	 */
+	Histogram2D(double x1, double y1, double x2, double y2, int cols, int rows, 
+				Shape shape = RECTANGLE, const Colormap &map = Colormap(), bool logScale = false) : 
+		map(map), x1(x1), y1(y1), x2(x2), y2(y2), 
+		sx((x2-x1)/cols), sy((y2-y1)/rows), shape(shape), logScale(logScale),
+		cols(shape == HEXAGON ? cols+1 : cols), rows(shape == HEXAGON ? rows+1 : rows),
+		counts(static_cast<std::size_t>(this->cols)*this->rows) {}
+	
+	/**
+	 * Counts a sample. Samples outside of the binned area are ignored.
+	 * @param x The X-coordinate of the sample.
+	 * @param y The Y-coordinate of the sample.
+	 */
+	void add(double x, double y) {
+		const long i = bin(x, y);
+		if(i >= 0)
+			counts[i]++;
+	}
+	
+	/**
+	 * Counts many samples, using several threads for large batches.
+	 * @param xs The X-coordinates of the samples.
+	 * @param ys The Y-coordinates of the samples.
+	 * @param n The number of samples.
+	 */
+	void add(const double *xs, const double *ys, std::size_t n) {
+		const unsigned threads = n < (1<<16) ? 1 : 
+			std::max(1u, std::thread::hardware_concurrency());
+		if(threads == 1) {
+			for(std::size_t i = 0; i < n; i++)
+				add(xs[i], ys[i]);
+			return;
+		}
+		
+		std::vector<std::vector<uint64_t>> grids(threads-1, 
+			std::vector<uint64_t>(counts.size()));
+		auto count = [&](std::size_t from, std::size_t to, uint64_t *grid) {
+			for(std::size_t i = from; i < to; i++) {
+				const long b = bin(xs[i], ys[i]);
+				if(b >= 0)
+					grid[b]++;
+			}
+		};
+		
+		std::vector<std::thread> workers;
+		for(unsigned t = 0; t+1 < threads; t++)
+			workers.emplace_back(count, n*t/threads, n*(t+1)/threads, grids[t].data());
+		count(n*(threads-1)/threads, n, counts.data());
+		for(std::thread &t : workers)
+			t.join();
+		
+		for(const std::vector<uint64_t> &g : grids)
+			for(std::size_t i = 0; i < counts.size(); i++)
+				counts[i] += g[i];
+	}
+	
+	/**
+	 * Removes all samples.
+	 */
+	void clear() {
+		std::fill(counts.begin(), counts.end(), 0);
+	}
+	
+	void bounds(double &minX, double &minY, double &maxX, double &maxY) const override {
+		minX = std::min(minX, std::min(x1, x2));
+		maxX = std::max(maxX, std::max(x1, x2));
+		minY = std::min(minY, std::min(y1, y2));
+		maxY = std::max(maxY, std::max(y1, y2));
+	}
+	
+	void draw(Plot &p) override {
+		if(map.colors.empty())
+			return;
+		
+		const uint64_t most = *std::max_element(counts.begin(), counts.end());
+		if(most == 0)
+			return;
+		
+		values.resize(counts.size());
+		for(std::size_t i = 0; i < counts.size(); i++)
+			values[i] = logScale ? std::log(static_cast<double>(counts[i])) : counts[i];
+		double low = map.low, high = map.high;
+		if(map.autoRange()) {
+			low = logScale ? 0 : 1;
+			high = logScale ? std::log(static_cast<double>(most)) : most;
+			if(!(low < high))
+				high = low+1;
+		}
+		colors.resize(counts.size());
+		map.map(values.data(), colors.data(), counts.size(), low, high);
+		
+		for(int y = 0; y < p.h*2; y++) {
+			const double cy = p.topLeft.y+(y+0.5)*p.dy/(p.h*2);
+			for(int x = 0; x < p.w; x++) {
+				const double cx = p.topLeft.x+(x+0.5)*p.dx/p.w;
+				const long i = bin(cx, cy);
+				if(i >= 0 && counts[i] > 0)
+					drawPoint(p, {cx, cy}, colors[i], Plot::BLOCK);
+			}
+		}
+	}
+	
+private:
+	double x1, y1, x2, y2, sx, sy;
+	Shape shape;
+	bool logScale;
+	int cols, rows;
+	std::vector<uint64_t> counts;
+	std::vector<double> values;
+	std::vector<int8_t> colors;
+	
+	// Index of the bin of a point, or -1 outside of the grid.
+	long bin(double x, double y) const {
+		double px = (x-x1)/sx, py = (y-y1)/sy;
+		if(!(px >= 0 && px <= cols && py >= 0 && py <= rows))
+			return -1;
+		
+		long i, j;
+		if(shape == RECTANGLE) {
+			i = std::min<long>(px, cols-1);
+			j = std::min<long>(py, rows-1);
+		}
+		else {
+			// Nearest center of the hexagonal lattice: the nearest one of the
+			// row, unless the point lies in the triangle belonging to the
+			// next row up or down.
+			double pj = std::floor(py+0.5);
+			px -= 0.5*(static_cast<long>(pj)&1);
+			double pi = std::floor(px+0.5);
+			const double py1 = py-pj;
+			if(std::abs(py1)*3 > 1) {
+				const double px1 = px-pi;
+				const double pi2 = pi+(px < pi ? -0.5 : 0.5);
+				const double pj2 = pj+(py < pj ? -1 : 1);
+				const double px2 = px-pi2, py2 = py-pj2;
+				if(px1*px1+py1*py1 > px2*px2+py2*py2) {
+					pi = pi2+((static_cast<long>(pj)&1) ? 0.5 : -0.5);
+					pj = pj2;
+				}
+			}
+			i = pi;
+			j = pj;
+			if(i < 0 || i >= cols || j < 0 || j >= rows)
+				return -1;
+		}
+		return j*cols+i;
+	}
+};
+
+/**
+ * Kernel density estimate of the distribution of samples, drawn as a curve
+ * at the resolution of the columns of the plot.
+ * Samples are spread over a regular grid (linear binning) and the grid is
+ * smoothed with a Gaussian kernel by multiplication in the frequency domain,
+ * so a frame costs a pass over the samples plus one FFT of the grid, instead
+ * of one kernel evaluation per sample and column.
+ */
+class KernelDensity : public Series {
+public:
+	/**
+	 * @param color The color of the curve.
+	 * @param character The character to be used for drawing the curve, by default, is the Unicode square/block character.
+	 * @param bandwidth The standard deviation of the kernel, or 0 to use
+	 * Silverman's rule of thumb.
+	 */
+	KernelDensity(int8_t color = WHITE, char character = '\0', double bandwidth = 0) : 
+		color(color), character(character), fixedBandwidth(bandwidth) {}
+	
+	/**
+	 * Adds a sample. NaN and infinite values are ignored.
+	 * @param v The value of the sample.
+	 */
+	void add(double v) {
+		if(!finite(v))
+			return;
+		
+		samples.push_back(v);
+		const double d = v-mean;
+		mean += d/samples.size();
+		m2 += d*(v-mean);
+		quantiles.add(v);
+		peak = -1;
+	}
+	
+	/**
+	 * Adds many samples.
+	 * @param v The values of the samples.
+	 * @param n The number of samples.
+	 */
+	void add(const double *v, std::size_t n) {
+		for(std::size_t i = 0; i < n; i++)
+			add(v[i]);
+	}
+	
+	/**
+	 * Removes all samples.
+	 */
+	void clear() {
+		samples.clear();
+		quantiles.clear();
+		mean = m2 = 0;
+		peak = -1;
+	}
+	
+	/**
+	 * @return The bandwidth used, for the current samples.
+	 */
+	double bandwidth() const {
+		if(fixedBandwidth > 0)
+			return fixedBandwidth;
+		
+		const std::size_t n = samples.size();
+		const double deviation = n > 1 ? std::sqrt(m2/(n-1)) : 0;
+		const double iqr = n > 0 ? (quantiles.quantile(0.75)-quantiles.quantile(0.25))/1.34 : 0;
+		double s = iqr > 0 ? std::min(deviation, iqr) : deviation;
+		if(!(s > 0))
+			s = std::max(1.0, std::abs(mean))*1e-3;
+		return 0.9*s*std::pow(static_cast<double>(n), -0.2);
+	}
+	
+	void bounds(double &minX, double &minY, double &maxX, double &maxY) const override {
+		if(samples.empty())
+			return;
+		
+		const double h = bandwidth();
+		const double x1 = quantiles.quantile(0)-3*h, x2 = quantiles.quantile(1)+3*h;
+		if(peak < 0) {
+			estimate(x1, x2, 1024);
+			peak = *std::max_element(grid.begin(), grid.end());
+		}
+		minX = std::min(minX, x1);
+		maxX = std::max(maxX, x2);
+		minY = std::min(minY, 0.0);
+		maxY = std::max(maxY, peak);
+	}
+	
+	void draw(Plot &p) override {
+		if(samples.empty() || p.w < 1)
+			return;
+		
+		const double step = p.dx/p.w;
+		const double x1 = std::min(p.topLeft.x, p.topLeft.x+p.dx);
+		const double x2 = std::max(p.topLeft.x, p.topLeft.x+p.dx);
+		estimate(x1, x2, 4*p.w);
+		
+		Plot::Point last = {0, 0};
+		for(int c = 0; c < p.w; c++) {
+			const double x = p.topLeft.x+(c+0.5)*step;
+			const double t = (x-first)/spacing;
+			const std::size_t i = std::min<std::size_t>(t, grid.size()-2);
+			const double f = t-i;
+			const Plot::Point a = {x, grid[i]*(1-f)+grid[i+1]*f};
+			if(c > 0)
+				drawLine(p, {last, a}, color, character);
+			last = a;
+		}
+	}
+	
+private:
+	int8_t color;
+	char character;
+	double fixedBandwidth;
+	std::vector<double> samples;
+	QuantileSketch quantiles;
+	double mean = 0, m2 = 0;
+	mutable double peak = -1;
+	mutable std::unique_ptr<FFT> fft;
+	mutable std::vector<double> grid, im;
+	mutable double first = 0, spacing = 1;
+	
+	// Evaluates the density on the grid, covering [x1, x2] with at least
+	// the given number of points, plus margins of four bandwidths, so that
+	// the wrap-around of the circular convolution is negligible.
+	void estimate(double x1, double x2, std::size_t points) const {
+		const double h = bandwidth();
+		std::size_t m = 64;
+		while(m < points*(x2-x1+8*h)/std::max(x2-x1, h) && m < (1<<20))
+			m *= 2;
+		if(!fft || fft->size() != m)
+			fft.reset(new FFT(m));
+		
+		first = x1-4*h;
+		spacing = (x2-x1+8*h)/(m-1);
+		grid.assign(m, 0);
+		im.assign(m, 0);
+		for(double v : samples) {
+			const double t = (v-first)/spacing;
+			if(t >= 0 && t < m-1) {
+				const std::size_t i = t;
+				grid[i] += i+1-t;
+				grid[i+1] += t-i;
+			}
+		}
+		
+		fft->transform(grid.data(), im.data());
+		const double pi = std::acos(-1.0);
+		const double c = -2*pi*pi*h*h/(m*spacing*m*spacing);
+		for(std::size_t k = 0; k < m; k++) {
+			const double f = k <= m/2 ? k : static_cast<double>(k)-m;
+			const double g = std::exp(c*f*f);
+			grid[k] *= g;
+			im[k] *= g;
+		}
+		fft->transform(grid.data(), im.data(), true);
+		
+		const double scale = 1/(m*samples.size()*spacing);
+		for(double &v : grid)
+			v = std::max(0.0, v*scale);
+	}
+};
+
+/**
+ * Spectrum analyzer of a stream of samples, e.g. audio or vibration.
+ * A worker thread computes the spectrum of the newest block of samples
+ * whenever enough new ones arrived, using a Hann window and a real FFT, so
+ * pushing samples and drawing never wait for the transform. The magnitude is
+ * drawn in decibels against the decimal logarithm of the frequency: the
+ * X-coordinate of a frequency f is log10(f). Where several frequencies fall
+ * into one column, their maximum is drawn.
+ */
+class Spectrum : public Series {
+public:
+	/**
+	 * Starts the worker thread.
+	 * 
+	 * @param size The number of samples of a block, a power of two of at least 4.
+	 * @param sampleRate The number of samples per second.
+	 * @param color The color of the curve.
+	 * @param character The character to be used for drawing the curve, by default, is the Unicode square/block character.
+	 * @param hop The number of new samples after which the spectrum is computed again, size/4 by default.
+	 */
+	Spectrum(std::size_t size, double sampleRate, int8_t color = WHITE, 
+			 char character = '\0', std::size_t hop = 0) : 
+			size(size), rate(sampleRate), hop(hop ? hop : size/4), color(color), 
+			character(character), fft(size/2), ring(size), window(size), block(size), 
+			re(size/2+1), im(size/2+1), levels(size/2+1), result(size/2+1, floor) {
+		const double pi = std::acos(-1.0);
+		double sum = 0;
+		for(std::size_t i = 0; i < size; i++)
+			sum += window[i] = 0.5-0.5*std::cos(2*pi*i/size);
+		// A sine of amplitude 1 reads 0 dB.
+		for(double &w : window)
+			w *= 2/sum;
+		
+		worker = std::thread(&Spectrum::run, this);
+	}
+	
+	~Spectrum() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopped = true;
+		}
+		ready.notify_one();
+		worker.join();
+	}
+	
+	/**
+	 * Appends samples to the stream.
+	 * @param samples The samples.
+	 * @param n The number of samples.
+	 */
+	void push(const double *samples, std::size_t n) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if(n > size) {
+			samples += n-size;
+			fresh += n-size;
+			n = size;
+		}
+		while(n > 0) {
+			const std::size_t m = std::min(n, size-position);
+			std::copy(samples, samples+m, ring.begin()+position);
+			position = (position+m)%size;
+			samples += m;
+			n -= m;
+			fresh += m;
+		}
+		if(fresh >= hop)
+			ready.notify_one();
+	}
+	
+	void bounds(double &minX, double &minY, double &maxX, double &maxY) const override {
+		std::lock_guard<std::mutex> lock(mutex);
+		minX = std::min(minX, std::log10(rate/size));
+		maxX = std::max(maxX, std::log10(rate/2));
+		for(std::size_t k = 1; k < result.size(); k++) {
+			minY = std::min(minY, result[k]);
+			maxY = std::max(maxY, result[k]);
+		}
+	}
+	
+	void draw(Plot &p) override {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			levels = result;
+		}
+		
+		bool started = false;
+		long column = 0;
+		Plot::Point last = {0, 0}, top = {0, 0};
+		for(std::size_t k = 1; k < levels.size(); k++) {
+			const Plot::Point a = {std::log10(k*rate/size), levels[k]};
+			const long c = std::floor((a.x-p.topLeft.x)*p.w/p.dx);
+			if(k > 1 && c == column) {
+				if(a.y > top.y)
+					top = a;
+				continue;
+			}
+			if(k > 1) {
+				if(started)
+					drawLine(p, {last, top}, color, character);
+				last = top;
+				started = true;
+			}
+			top = a;
+			column = c;
+		}
+		if(started)
+			drawLine(p, {last, top}, color, character);
+		else
+			drawPoint(p, top, color, character);
+	}
+	
+private:
+	const double floor = -200;
+	std::size_t size;
+	double rate;
+	std::size_t hop;
+	int8_t color;
+	char character;
+	FFT fft;
+	
+	mutable std::mutex mutex;
+	std::condition_variable ready;
+	bool stopped = false;
+	std::vector<double> ring;
+	std::size_t position = 0, fresh = 0;
+	
+	std::vector<double> window, block, re, im, levels;
+	std::vector<double> result;
+	std::thread worker;
+	
+	void run() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while(true) {
+			ready.wait(lock, [this]{return stopped || fresh >= hop;});
+			if(stopped)
+				return;
+			
+			// The ring holds the newest samples, the oldest at the position.
+			std::copy(ring.begin()+position, ring.end(), block.begin());
+			std::copy(ring.begin(), ring.begin()+position, block.end()-position);
+			fresh = 0;
+			lock.unlock();
+			
+			for(std::size_t i = 0; i < size; i++)
+				block[i] *= window[i];
+			fft.transformReal(block.data(), re.data(), im.data());
+			for(std::size_t k = 0; k < re.size(); k++) {
+				const double power = re[k]*re[k]+im[k]*im[k];
+				re[k] = power > 0 ? std::max(floor, 10*std::log10(power)) : floor;
+			}
+			
+			lock.lock();
+			result.swap(re);
+			re.resize(result.size());
+		}
+	}
+};
+
+/**
+ * Samples of a time series, ordered by their X-coordinates, drawn as a line
+ * strip. Only the samples in the drawing range and their neighbours are
+ * visited when drawing. Samples are also the sources of derived series,
+ * which may be attached instead of, or together with, their sources.
+ */
+class Samples : public Series {
+public:
+	/**
+	 * @param color The color of the line.
+	 * @param character The character to be used for drawing the line, by default, is the Unicode square/block character.
+	 */
+	Samples(int8_t color = WHITE, char character = '\0') : color(color), character(character) {}
+	
+	/**
+	 * Adds a sample. Samples are expected in increasing order of X; an
+	 * older one is inserted at its place, which costs a copy of the newer
+	 * ones. A NaN Y-coordinate breaks the line; samples with a NaN or
+	 * infinite X-coordinate are ignored.
+	 * 
+	 * @param x The X-coordinate of the sample.
+	 * @param y The value of the sample.
+	 */
+	void add(double x, double y) {
+		if(!finite(x))
+			return;
+		
+		changes++;
+		if(xs.empty() || x >= xs.back()) {
+			xs.push_back(x);
+			ys.push_back(y);
+		}
+		else {
+			const std::size_t i = std::upper_bound(xs.begin(), xs.end(), x)-xs.begin();
+			xs.insert(xs.begin()+i, x);
+			ys.insert(ys.begin()+i, y);
+		}
+	}
+	
+	/**
+	 * Adds many samples.
+	 * @param x The X-coordinates of the samples.
+	 * @param y The values of the samples.
+	 * @param n The number of samples.
+	 */
+	void add(const double *x, const double *y, std::size_t n) {
+		xs.reserve(xs.size()+n);
+		ys.reserve(ys.size()+n);
+		for(std::size_t i = 0; i < n; i++)
+			add(x[i], y[i]);
+	}
+	
+	/**
+	 * Removes all samples.
+	 */
+	void clear() {
+		xs.clear();
+		ys.clear();
+		changes++;
+	}
+	
+	/**
+	 * @return A number which changes whenever samples are added or removed.
+	 */
+	std::size_t revision() const {
+		return changes;
+	}
+	
+	/**
+	 * @return The number of samples.
+	 */
+	std::size_t size() const {
+		return xs.size();
+	}
+	
+	/**
+	 * @return The X-coordinates of the samples, in increasing order.
+	 */
+	const double *xValues() const {
+		return xs.data();
+	}
+	
+	/**
+	 * @return The values of the samples.
+	 */
+	const double *yValues() const {
+		return ys.data();
+	}
+	
+	/**
+	 * @param x An X-coordinate.
+	 * @return The index of the first sample at or after the coordinate.
+	 */
+	std::size_t lowerBound(double x) const {
+		return std::lower_bound(xs.begin(), xs.end(), x)-xs.begin();
+	}
+	
+	/**
+	 * Computes the increases of a counter between consecutive samples.
+	 * A decrease means that the counter was reset to zero, so the increase
+	 * is the new value; with a modulus, a decrease that would be an increase
+	 * by less than half of it is taken as a wraparound instead. The loop is
+	 * free of branches.
+	 * 
+	 * @param y The n+1 values of the counter.
+	 * @param d The n increases.
+	 * @param n The number of increases.
+	 * @param modulus The value at which the counter wraps around to 0, or 0 if it does not.
+	 */
+	static void increases(const double *y, double *d, std::size_t n, double modulus = 0) {
+		const double half = modulus > 0 ? modulus/2 : -std::numeric_limits<double>::infinity();
+		for(std::size_t i = 0; i < n; i++) {
+			const double a = y[i+1]-y[i], wrapped = a+modulus;
+			const double fixed = wrapped < half ? wrapped : y[i+1];
+			d[i] = a < 0 ? fixed : a;
+		}
+	}
+	
+	/**
+	 * Finds the samples to visit for drawing: those in the drawing range and
+	 * one more on each side.
+	 * 
+	 * @param p The plot being rendered.
+	 * @param from The index of the first sample.
+	 * @param to The index after the last sample.
+	 */
+	void visible(const Plot &p, std::size_t &from, std::size_t &to) const {
+		double x1, x2;
+		visibleX(p, x1, x2);
+		from = lowerBound(x1);
+		from -= from > 0;
+		to = std::min(xs.size(), lowerBound(x2)+1);
+	}
+	
+	void bounds(double &minX, double &minY, double &maxX, double &maxY) const override {
+		if(xs.empty())
+			return;
+		
+		minX = std::min(minX, xs.front());
+		maxX = std::max(maxX, xs.back());
+		for(double y : ys) {
+			if(finite(y)) {
+				minY = std::min(minY, y);
+				maxY = std::max(maxY, y);
+			}
+		}
+	}
+	
+	void draw(Plot &p) override {
+		std::size_t from, to;
+		visible(p, from, to);
+		for(std::size_t i = from+1; i < to; i++) {
+			if(finite(ys[i-1]) && finite(ys[i]))
+				drawLine(p, {{xs[i-1], ys[i-1]}, {xs[i], ys[i]}}, color, character);
+		}
+	}
+	
+private:
+	int8_t color;
+	char character;
+	std::vector<double> xs, ys;
+	std::size_t changes = 0;
+};
+
+/**
+ * Smoothed version of samples, computed while drawing: only the visible
+ * samples, and the preceding ones the filter needs to settle, are filtered,
+ * each in constant time (moving average, exponential moving average) or in
+ * logarithmic time of the window (moving median). Nothing is stored besides
+ * the window. NaN and infinite values are skipped.
+ */
+class Smoothed : public Series {
+public:
+	enum Filter {MOVING_AVERAGE, EXPONENTIAL, MEDIAN};
+	
+	/**
+	 * @param source The samples to smooth; they have to outlive the series.
+	 * @param filter The filter.
+	 * @param window The number of samples averaged, or for the exponential
+	 * moving average, the window of the same centre of mass, i.e. a weight of
+	 * 2/(window+1) of the newest sample.
+	 * @param color The color of the line.
+	 * @param character The character to be used for drawing the line, by default, is the Unicode square/block character.
+	 */
+	Smoothed(const Samples &source, Filter filter, std::size_t window, 
+			 int8_t color = WHITE, char character = '\0') : 
+		source(source), filter(filter), window(std::max<std::size_t>(window, 1)), 
+		color(color), character(character) {}
+	
+	void bounds(double &minX, double &minY, double &maxX, double &maxY) const override {
+		source.bounds(minX, minY, maxX, maxY);
+	}
+	
+	void draw(Plot &p) override {
+		std::size_t from, to;
+		source.visible(p, from, to);
+		// The exponential filter forgets its start after a few windows.
+		const std::size_t settle = filter == EXPONENTIAL ? 8*window : window-1;
+		std::size_t i = from > settle ? from-settle : 0;
+		
+		const double *xs = source.xValues(), *ys = source.yValues();
+		const double alpha = 2.0/(window+1);
+		double sum = 0, ema = std::numeric_limits<double>::quiet_NaN();
+		std::deque<double> values;
+		low.clear();
+		high.clear();
+		
+		bool started = false;
+		Plot::Point last = {0, 0};
+		for(; i < to; i++) {
+			const double v = ys[i];
+			if(!finite(v))
+				continue;
+			
+			double y;
+			if(filter == EXPONENTIAL) {
+				ema = ema == ema ? ema+alpha*(v-ema) : v;
+				y = ema;
+			}
+			else {
+				values.push_back(v);
+				if(filter == MOVING_AVERAGE)
+					sum += v;
+				else
+					insert(v);
+				
+				if(values.size() > window) {
+					const double old = values.front();
+					values.pop_front();
+					if(filter == MOVING_AVERAGE)
+						sum -= old;
+					else
+						erase(old);
+				}
+				y = filter == MOVING_AVERAGE ? sum/values.size() : median();
+			}
+			
+			if(i < from)
+				continue;
+			const Plot::Point a = {xs[i], y};
+			if(started)
+				drawLine(p, {last, a}, color, character);
+			last = a;
+			started = true;
+		}
+	}
+	
+private:
+	const Samples &source;
+	Filter filter;
+	std::size_t window;
+	int8_t color;
+	char character;
+	// The lower half of the window of the median, and the upper half, 
+	// which is never larger.
+	std::multiset<double> low, high;
+	
+	void insert(double v) {
+		if(low.empty() || v <= *low.rbegin())
+			low.insert(v);
+		else
+			high.insert(v);
+		balance();
+	}
+	
+	void erase(double v) {
+		if(v <= *low.rbegin())
+			low.erase(low.find(v));
+		else
+			high.erase(high.find(v));
+		balance();
+	}
+	
+	void balance() {
+		if(low.size() > high.size()+1) {
+			high.insert(*low.rbegin());
+			low.erase(std::prev(low.end()));
+		}
+		else if(high.size() > low.size()) {
+			low.insert(*high.begin());
+			high.erase(high.begin());
+		}
+	}
+	
+	double median() const {
+		return low.size() > high.size() ? *low.rbegin() : (*low.rbegin()+*high.begin())/2;
+	}
+};
+
+/**
+ * Series defined by arithmetic on other series, e.g. errors/requests or
+ * bytes*8, and by rates and derivatives of series. Expressions are only
+ * descriptions: they are evaluated when drawn, and only over the drawing
+ * range, one whole array at a time.
+ * Two series are joined by timestamp: the result has a sample at each
+ * X-coordinate of either operand, from which both have started, and each
+ * operand contributes its latest value at or before it.
+ */
+class Expression {
+public:
+	/**
+	 * @param source The samples; they have to outlive the expression.
+	 */
+	Expression(const Samples &source) : node(new Source(source)) {}
+	
+	/**
+	 * @param value The constant.
+	 */
+	Expression(double value) : node(new Constant(value)) {}
+	
+	friend Expression operator+(const Expression &a, const Expression &b);
+	friend Expression operator-(const Expression &a, const Expression &b);
+	friend Expression operator*(const Expression &a, const Expression &b);
+	friend Expression operator/(const Expression &a, const Expression &b);
+	
+	/**
+	 * @return The per-unit-of-X rate of a counter: the increase between
+	 * consecutive samples over their distance. A decrease is taken as a reset
+	 * of the counter to zero, so the increase is the new value.
+	 */
+	Expression rate() const {
+		return Expression(new Difference(node, true));
+	}
+	
+	/**
+	 * @return The difference between consecutive samples over their distance.
+	 */
+	Expression derivative() const {
+		return Expression(new Difference(node, false));
+	}
+	
+	/**
+	 * Evaluates the expression over a range of X-coordinates, including one
+	 * sample before and one after it when there are. A constant alone has no
+	 * samples.
+	 * 
+	 * @param x1 The lowest X-coordinate.
+	 * @param x2 The highest X-coordinate.
+	 * @param xs The X-coordinates of the results.
+	 * @param ys The results.
+	 */
+	void evaluate(double x1, double x2, std::vector<double> &xs, std::vector<double> &ys) const {
+		xs.clear();
+		ys.clear();
+		node->evaluate(x1, x2, 1, xs, ys);
+	}
+	
+private:
+	struct Node {
+		virtual ~Node() = default;
+		
+		// Fills the empty xs and ys with the samples in [x1, x2], plus the
+		// given number of samples before and one after. Constants leave them empty.
+		virtual void evaluate(double x1, double x2, std::size_t before, 
+							  std::vector<double> &xs, std::vector<double> &ys) const = 0;
+		
+		virtual bool constant(double &value) const {
+			(void)value;
+			return false;
+		}
+	};
+	
+	struct Constant : Node {
+		double value;
+		
+		Constant(double value) : value(value) {}
+		
+		void evaluate(double, double, std::size_t, 
+					  std::vector<double> &, std::vector<double> &) const override {}
+		
+		bool constant(double &v) const override {
+			v = value;
+			return true;
+		}
+	};
+	
+	struct Source : Node {
+		const Samples &source;
+		
+		Source(const Samples &source) : source(source) {}
+		
+		void evaluate(double x1, double x2, std::size_t before, 
+					  std::vector<double> &xs, std::vector<double> &ys) const override {
+			std::size_t from = source.lowerBound(x1);
+			from -= std::min(from, before);
+			const std::size_t to = std::min(source.size(), source.lowerBound(x2)+1);
+			if(from >= to)
+				return;
+			xs.assign(source.xValues()+from, source.xValues()+to);
+			ys.assign(source.yValues()+from, source.yValues()+to);
+		}
+	};
+	
+	struct Binary : Node {
+		char op;
+		std::shared_ptr<const Node> a, b;
+		
+		Binary(char op, std::shared_ptr<const Node> a, std::shared_ptr<const Node> b) : 
+			op(op), a(a), b(b) {}
+		
+		void evaluate(double x1, double x2, std::size_t before, 
+					  std::vector<double> &xs, std::vector<double> &ys) const override {
+			double ca, cb;
+			const bool constA = a->constant(ca), constB = b->constant(cb);
+			if(constA && constB)
+				return;
+			
+			std::vector<double> xa, ya, xb, yb;
+			if(constA || constB) {
+				(constA ? b : a)->evaluate(x1, x2, before, xs, ys);
+				std::vector<double> c(ys.size(), constA ? ca : cb);
+				if(constA)
+					apply(c.data(), ys.data(), ys.data(), ys.size());
+				else
+					apply(ys.data(), c.data(), ys.data(), ys.size());
+				return;
+			}
+			
+			a->evaluate(x1, x2, before, xa, ya);
+			b->evaluate(x1, x2, before, xb, yb);
+			if(xa == xb) {
+				ys.resize(ya.size());
+				apply(ya.data(), yb.data(), ys.data(), ys.size());
+				xs.swap(xa);
+				return;
+			}
+			
+			// Merge join, holding the latest value of each operand.
+			std::vector<double> va, vb;
+			std::size_t i = 0, j = 0;
+			while(i < xa.size() || j < xb.size()) {
+				const double x = j == xb.size() || (i < xa.size() && xa[i] <= xb[j]) ? xa[i] : xb[j];
+				while(i < xa.size() && xa[i] == x)
+					i++;
+				while(j < xb.size() && xb[j] == x)
+					j++;
+				if(i > 0 && j > 0) {
+					xs.push_back(x);
+					va.push_back(ya[i-1]);
+					vb.push_back(yb[j-1]);
+				}
+			}
+			ys.resize(xs.size());
+			apply(va.data(), vb.data(), ys.data(), ys.size());
+		}
+		
+		void apply(const double *u, const double *v, double *out, std::size_t n) const {
+			switch(op) {
+			case '+': for(std::size_t i = 0; i < n; i++) out[i] = u[i]+v[i]; break;
+			case '-': for(std::size_t i = 0; i < n; i++) out[i] = u[i]-v[i]; break;
+			case '*': for(std::size_t i = 0; i < n; i++) out[i] = u[i]*v[i]; break;
+			case '/': for(std::size_t i = 0; i < n; i++) out[i] = u[i]/v[i]; break;
+			}
+		}
+	};
+	
+	struct Difference : Node {
+		std::shared_ptr<const Node> a;
+		bool counter;
+		
+		Difference(std::shared_ptr<const Node> a, bool counter) : a(a), counter(counter) {}
+		
+		void evaluate(double x1, double x2, std::size_t before, 
+					  std::vector<double> &xs, std::vector<double> &ys) const override {
+			std::vector<double> x, y;
+			a->evaluate(x1, x2, before+1, x, y);
+			if(x.size() < 2)
+				return;
+			
+			const std::size_t n = x.size()-1;
+			xs.assign(x.begin()+1, x.end());
+			ys.resize(n);
+			if(counter)
+				Samples::increases(y.data(), ys.data(), n);
+			else
+				for(std::size_t i = 0; i < n; i++)
+					ys[i] = y[i+1]-y[i];
+			for(std::size_t i = 0; i < n; i++)
+				ys[i] /= x[i+1]-x[i];
+		}
+	};
+	
+	std::shared_ptr<const Node> node;
+	
+	explicit Expression(const Node *node) : node(node) {}
+};
+
+inline Expression operator+(const Expression &a, const Expression &b) {
+	return Expression(new Expression::Binary('+', a.node, b.node));
+}
+
+inline Expression operator-(const Expression &a, const Expression &b) {
+	return Expression(new Expression::Binary('-', a.node, b.node));
+}
+
+inline Expression operator*(const Expression &a, const Expression &b) {
+	return Expression(new Expression::Binary('*', a.node, b.node));
+}
+
+inline Expression operator/(const Expression &a, const Expression &b) {
+	return Expression(new Expression::Binary('/', a.node, b.node));
+}
+
+/**
+ * Line through the values of an expression, evaluated over the drawing range
+ * each time the plot is rendered.
+ */
+class Derived : public Series {
+public:
+	/**
+	 * @param e The expression.
+	 * @param color The color of the line.
+	 * @param character The character to be used for drawing the line, by default, is the Unicode square/block character.
+	 */
+	Derived(const Expression &e, int8_t color = WHITE, char character = '\0') : 
+		e(e), color(color), character(character) {}
+	
+	void bounds(double &minX, double &minY, double &maxX, double &maxY) const override {
+		const double inf = std::numeric_limits<double>::infinity();
+		e.evaluate(-inf, inf, xs, ys);
+		for(std::size_t i = 0; i < xs.size(); i++) {
+			if(!finite(ys[i]))
+				continue;
+			minX = std::min(minX, xs[i]);
+			maxX = std::max(maxX, xs[i]);
+			minY = std::min(minY, ys[i]);
+			maxY = std::max(maxY, ys[i]);
+		}
+	}
+	
+	void draw(Plot &p) override {
+		double x1, x2;
+		visibleX(p, x1, x2);
+		e.evaluate(x1, x2, xs, ys);
+		for(std::size_t i = 1; i < xs.size(); i++) {
+			if(finite(ys[i-1]) && finite(ys[i]))
+				drawLine(p, {{xs[i-1], ys[i-1]}, {xs[i], ys[i]}}, color, character);
+		}
+	}
+	
+private:
+	Expression e;
+	int8_t color;
+	char character;
+	mutable std::vector<double> xs, ys;
+};
+
+/**
+ * Rates of a monotonically increasing counter, computed from its raw samples
+ * when drawing, per bucket of X-coordinates: by default, per column of the
+ * plot. Counter resets and wraparounds are accounted for (see
+ * Samples::increases()), over blocks of the visible samples at a time.
+ */
+class CounterRate : public Series {
+public:
+	/**
+	 * RATE averages the rate over all the samples of a bucket; IRATE takes
+	 * the rate between its last two samples, which follows spikes.
+	 */
+	enum Mode {RATE, IRATE};
+	
+	/**
+	 * @param mode How the rate of a bucket is computed.
+	 * @param modulus The value at which the counter wraps around to 0, or 0 if it does not.
+	 * @param color The color of the line.
+	 * @param character The character to be used for drawing the line, by default, is the Unicode square/block character.
+	 * @param bucketWidth The width of a bucket in X-coordinates, or 0 for one column.
+	 */
+	CounterRate(Mode mode = RATE, double modulus = 0, int8_t color = WHITE, 
+				char character = '\0', double bucketWidth = 0) : 
+		mode(mode), modulus(modulus), color(color), character(character), width(bucketWidth) {}
+	
+	/**
+	 * Adds a sample of the counter.
+	 * @param x The X-coordinate, e.g. the time, of the sample.
+	 * @param counter The value of the counter.
+	 */
+	void add(double x, double counter) {
+		samples.add(x, counter);
+	}
+	
+	/**
+	 * Removes all samples.
+	 */
+	void clear() {
+		samples.clear();
+	}
+	
+	void bounds(double &minX, double &minY, double &maxX, double &maxY) const override {
+		const std::size_t n = samples.size();
+		if(n < 2)
+			return;
+		
+		const double *xs = samples.xValues(), *ys = samples.yValues();
+		minX = std::min(minX, xs[0]);
+		maxX = std::max(maxX, xs[n-1]);
+		minY = std::min(minY, 0.0);
+		double d[BLOCK];
+		for(std::size_t i = 0; i+1 < n; i += BLOCK) {
+			const std::size_t m = std::min<std::size_t>(BLOCK, n-1-i);
+			Samples::increases(ys+i, d, m, modulus);
+			for(std::size_t j = 0; j < m; j++) {
+				const double r = d[j]/(xs[i+j+1]-xs[i+j]);
+				if(finite(r))
+					maxY = std::max(maxY, r);
+			}
+		}
+	}
+	
+	void draw(Plot &p) override {
+		std::size_t from, to;
+		samples.visible(p, from, to);
+		if(to < from+2)
+			return;
+		
+		double x1, x2;
+		visibleX(p, x1, x2);
+		const double bucket = width > 0 ? width : (x2-x1)/p.w;
+		const double origin = width > 0 ? 0 : x1;
+		
+		const double *xs = samples.xValues(), *ys = samples.yValues();
+		bool started = false, open = false;
+		Plot::Point last = {0, 0};
+		long current = 0;
+		double sum = 0, start = 0, end = 0, instant = 0;
+		double d[BLOCK];
+		// The increase from sample i to i+1 belongs to the bucket of i+1.
+		for(std::size_t i = from; i+1 < to; i += BLOCK) {
+			const std::size_t m = std::min<std::size_t>(BLOCK, to-1-i);
+			Samples::increases(ys+i, d, m, modulus);
+			for(std::size_t j = 0; j < m; j++) {
+				const double a = xs[i+j], b = xs[i+j+1];
+				if(!finite(d[j]) || !(b > a))
+					continue;
+				
+				const long k = std::floor((b-origin)/bucket);
+				if(open && k != current) {
+					const Plot::Point q = {origin+(current+0.5)*bucket, 
+						mode == RATE ? sum/(end-start) : instant};
+					if(started)
+						drawLine(p, {last, q}, color, character);
+					last = q;
+					started = true;
+					open = false;
+				}
+				if(!open) {
+					current = k;
+					sum = 0;
+					start = a;
+					open = true;
+				}
+				sum += d[j];
+				end = b;
+				instant = d[j]/(b-a);
+			}
+		}
+		if(open) {
+			const Plot::Point q = {origin+(current+0.5)*bucket, 
+				mode == RATE ? sum/(end-start) : instant};
+			if(started)
+				drawLine(p, {last, q}, color, character);
+			else
+				drawPoint(p, q, color, character);
+		}
+	}
+	
+private:
+	enum {BLOCK = 256};
+	Mode mode;
+	double modulus;
+	int8_t color;
+	char character;
+	double width;
+	Samples samples;
+};
+
+/**
+ * Time series kept in fixed memory for long-running plots, in tiers of
+ * decreasing resolution, like a round-robin database: e.g. raw samples for
+ * an hour, 10 s buckets for a day and 5 min buckets for a month. Every sample
+ * is consolidated on arrival into the current bucket of each tier (minimum,
+ * maximum, sum and count), and each tier keeps a fixed number of entries,
+ * overwriting the oldest ones.
+ * When drawing, the finest tier that still covers the left edge of the
+ * drawing range is used, or a coarser one if its buckets are still narrower
+ * than a column. Buckets are drawn as a band from their minima to their
+ * maxima with a line through their averages, broken where the buckets are
+ * much further apart than usual; a bucket alone is drawn as a column.
+ */
+class Archive : public Series {
+public:
+	struct Tier {
+		double resolution; // Width of a bucket in X-coordinates, or 0 for raw samples.
+		std::size_t length; // The number of buckets or samples kept.
+	};
+	
+	int8_t lineColor, bandColor;
+	
+	/**
+	 * @param tiers The tiers, in any order.
+	 * @param lineColor The color of the line through the samples or the averages.
+	 * @param bandColor The color of the band between the minima and maxima.
+	 * @param character The character to be used for drawing, by default, is the Unicode square/block character.
+	 */
+	Archive(const std::vector<Tier> &tiers, int8_t lineColor = WHITE, 
+			int8_t bandColor = DARK_GRAY, char character = '\0') : 
+			lineColor(lineColor), bandColor(bandColor), character(character) {
+		for(const Tier &t : tiers) {
+			if(t.length == 0)
+				continue;
+			if(t.resolution > 0)
+				levels.push_back({t.resolution, Ring<Bucket>(t.length)});
+			else
+				raw = Ring<Plot::Point>(t.length);
+		}
+		std::sort(levels.begin(), levels.end(), [](const Level &a, const Level &b) {
+			return a.resolution < b.resolution;
+		});
+	}
+	
+	/**
+	 * Adds a sample. Samples are expected in increasing order of X; older
+	 * ones than the newest are ignored, as are NaN and infinite values.
+	 * 
+	 * @param x The X-coordinate of the sample.
+	 * @param y The value of the sample.
+	 */
+	void add(double x, double y) {
+		if(!finite(x) || !finite(y) || x < newest)
+			return;
+		newest = x;
+		
+		if(raw.capacity() > 0)
+			raw.push({x, y});
+		
+		for(Level &l : levels) {
+			const long long k = std::floor(x/l.resolution);
+			if(l.buckets.size() == 0 || l.buckets.back().index != k)
+				l.buckets.push({k, y, y, 0, 0});
+			Bucket &b = l.buckets.back();
+			b.min = std::min(b.min, y);
+			b.max = std::max(b.max, y);
+			b.sum += y;
+			b.count++;
+		}
+	}
+	
+	/**
+	 * Removes all samples.
+	 */
+	void clear() {
+		raw.clear();
+		for(Level &l : levels)
+			l.buckets.clear();
+		newest = -std::numeric_limits<double>::infinity();
+	}
+	
+	void bounds(double &minX, double &minY, double &maxX, double &maxY) const override {
+		for(std::size_t i = 0; i < raw.size(); i++) {
+			minX = std::min(minX, raw[i].x);
+			maxX = std::max(maxX, raw[i].x);
+			minY = std::min(minY, raw[i].y);
+			maxY = std::max(maxY, raw[i].y);
+		}
+		for(const Level &l : levels) {
+			for(std::size_t i = 0; i < l.buckets.size(); i++) {
+				const Bucket &b = l.buckets[i];
+				minX = std::min(minX, l.x(b));
+				maxX = std::max(maxX, l.x(b));
+				minY = std::min(minY, b.min);
+				maxY = std::max(maxY, b.max);
+			}
+		}
+	}
+	
+	void draw(Plot &p) override {
+		double x1, x2;
+		visibleX(p, x1, x2);
+		const double column = (x2-x1)/p.w;
+		
+		// Tiers from the finest; -1 stands for the raw samples. The finest
+		// one reaching back to the left edge is used, or the coarsest one if
+		// none does, then coarser ones as long as their buckets fit a column.
+		const int last = static_cast<int>(levels.size())-1;
+		int tier = raw.capacity() > 0 ? -1 : 0;
+		if(tier > last)
+			return;
+		while(tier < last && !(tier < 0 ? raw.size() > 0 && raw[0].x <= x1 : 
+				levels[tier].buckets.size() > 0 && 
+				levels[tier].buckets[0].index*levels[tier].resolution <= x1))
+			tier++;
+		while(tier < last && levels[tier+1].resolution <= column)
+			tier++;
+		
+		if(tier < 0) {
+			const std::size_t from = first(raw, x1, [](const Plot::Point &a) {return a.x;});
+			for(std::size_t i = from+1; i < raw.size() && raw[i-1].x <= x2; i++)
+				drawLine(p, {raw[i-1], raw[i]}, lineColor, character);
+			return;
+		}
+		
+		const Level &l = levels[tier];
+		const Ring<Bucket> &r = l.buckets;
+		const std::size_t from = first(r, x1, [&l](const Bucket &b) {return l.x(b);});
+		std::size_t to = from;
+		while(to+1 < r.size() && l.x(r[to]) <= x2)
+			to++;
+		
+		// Only non-empty buckets are kept, so neighbours in the ring are
+		// joined unless they are much further apart than usual, i.e. than the
+		// median spacing of the visible ones.
+		std::vector<long long> steps;
+		for(std::size_t i = from+1; i <= to; i++)
+			steps.push_back(r[i].index-r[i-1].index);
+		long long usual = 1;
+		if(!steps.empty()) {
+			std::nth_element(steps.begin(), steps.begin()+steps.size()/2, steps.end());
+			usual = steps[steps.size()/2];
+		}
+		auto joined = [&](std::size_t i) {
+			return i > 0 && i < r.size() && r[i].index-r[i-1].index <= GAP*usual;
+		};
+		
+		for(int pass = 0; pass < 2; pass++) {
+			for(std::size_t i = from; i <= to; i++) {
+				const Bucket &a = r[i];
+				const double xa = l.x(a);
+				if(i < to && joined(i+1)) {
+					const Bucket &b = r[i+1];
+					if(pass == 0)
+						drawBand(p, xa, a.min, a.max, l.x(b), b.min, b.max, bandColor, character);
+					else
+						drawLine(p, {{xa, a.sum/a.count}, {l.x(b), b.sum/b.count}}, 
+								 lineColor, character);
+				}
+				else if(!joined(i) && !joined(i+1)) {
+					// A bucket without neighbours is drawn as a column.
+					if(pass == 0)
+						drawBand(p, xa, a.min, a.max, xa, a.min, a.max, bandColor, character);
+					else
+						drawPoint(p, {xa, a.sum/a.count}, lineColor, character);
+				}
+			}
+		}
+	}
+	
+private:
+	// Buckets more than this many times further apart than usual break the line.
+	enum {GAP = 4};
+	
+	// Fixed number of entries, overwriting the oldest; indexed from the oldest.
+	template<typename T>
+	class Ring {
+	public:
+		Ring(std::size_t capacity = 0) : items(capacity) {}
+		
+		std::size_t capacity() const {return items.size();}
+		std::size_t size() const {return count;}
+		const T &operator[](std::size_t i) const {return items[(head+i)%items.size()];}
+		T &back() {return items[(head+count-1)%items.size()];}
+		const T &back() const {return items[(head+count-1)%items.size()];}
+		
+		void push(const T &a) {
+			if(count < items.size())
+				items[(head+count++)%items.size()] = a;
+			else {
+				items[head] = a;
+				head = (head+1)%items.size();
+			}
+		}
+		
+		void clear() {
+			head = count = 0;
+		}
+		
+	private:
+		std::vector<T> items;
+		std::size_t head = 0, count = 0;
+	};
+	
+	struct Bucket {
+		long long index;
+		double min, max, sum;
+		std::size_t count;
+	};
+	
+	struct Level {
+		double resolution;
+		Ring<Bucket> buckets;
+		
+		double x(const Bucket &b) const {
+			return (b.index+0.5)*resolution;
+		}
+	};
+	
+	char character;
+	Ring<Plot::Point> raw;
+	std::vector<Level> levels;
+	double newest = -std::numeric_limits<double>::infinity();
+	
+	// The index of the last entry before x, or 0.
+	template<typename T, typename F>
+	static std::size_t first(const Ring<T> &r, double x, F key) {
+		std::size_t lo = 0, hi = r.size();
+		while(lo < hi) {
+			const std::size_t mid = (lo+hi)/2;
+			if(key(r[mid]) < x)
+				lo = mid+1;
+			else
+				hi = mid;
+		}
+		return lo > 0 ? lo-1 : 0;
+	}
+};
+
+/**
+ * Aligns several series sampled at different X-coordinates onto common
+ * ones, e.g. for comparing, combining or stacking them. The sorted series
+ * are merge-joined in one pass over the range, and the result is kept as one
+ * array per series, all of the same length, which are reused by later
+ * alignments. The common coordinates are either those of all the samples or
+ * a regular grid.
+ */
+class Alignment {
+public:
+	/**
+	 * How the value of a series is taken at a coordinate between its samples.
+	 * Where there is no such value, e.g. before the first sample, it is NaN.
+	 */
+	enum Interpolation {
+		PREVIOUS, // The latest sample at or before the coordinate.
+		NEAREST, // The nearest sample.
+		LINEAR // Linear interpolation between the samples around the coordinate.
+	};
+	
+	/**
+	 * @param mode The interpolation.
+	 */
+	Alignment(Interpolation mode = PREVIOUS) : mode(mode) {}
+	
+	/**
+	 * Adds a series to align, as the next column.
+	 * @param s The samples; they have to outlive the alignment.
+	 */
+	void add(const Samples &s) {
+		sources.push_back(&s);
+		values.emplace_back();
+	}
+	
+	/**
+	 * Aligns the series over a range of X-coordinates, including one more
+	 * coordinate on each side, e.g. for lines leaving the drawing range.
+	 * 
+	 * @param x1 The lowest X-coordinate.
+	 * @param x2 The highest X-coordinate.
+	 * @param step The spacing of a regular grid of coordinates, at the 
+	 * multiples of it, or 0 to use the coordinates of all samples.
+	 */
+	void align(double x1, double x2, double step = 0) {
+		const std::size_t k = sources.size();
+		xs.clear();
+		for(std::vector<double> &v : values)
+			v.clear();
+		cursor.resize(k);
+		end.resize(k);
+		
+		long long g = 0, last = -1;
+		double x0 = std::numeric_limits<double>::infinity();
+		if(step > 0) {
+			g = std::floor(x1/step)-1;
+			last = std::ceil(x2/step)+1;
+			x0 = g*step;
+		}
+		for(std::size_t j = 0; j < k; j++) {
+			const Samples &s = *sources[j];
+			std::size_t from = s.lowerBound(x1);
+			from -= from > 0;
+			end[j] = std::min(s.size(), s.lowerBound(x2)+1);
+			if(step <= 0 && from < end[j])
+				x0 = std::min(x0, s.xValues()[from]);
+		}
+		// Samples before the cursors lie before all the coordinates.
+		for(std::size_t j = 0; j < k; j++)
+			cursor[j] = sources[j]->lowerBound(x0);
+		
+		while(true) {
+			double x = std::numeric_limits<double>::infinity();
+			if(step > 0) {
+				if(g > last)
+					break;
+				x = g++*step;
+			}
+			else {
+				for(std::size_t j = 0; j < k; j++)
+					if(cursor[j] < end[j])
+						x = std::min(x, sources[j]->xValues()[cursor[j]]);
+				if(x == std::numeric_limits<double>::infinity())
+					break;
+			}
+			
+			xs.push_back(x);
+			for(std::size_t j = 0; j < k; j++) {
+				const Samples &s = *sources[j];
+				const double *sx = s.xValues();
+				std::size_t &c = cursor[j];
+				while(c < s.size() && sx[c] <= x)
+					c++;
+				values[j].push_back(valueAt(s, c, x));
+			}
+		}
+	}
+	
+	/**
+	 * @return The number of aligned coordinates.
+	 */
+	std::size_t size() const {
+		return xs.size();
+	}
+	
+	/**
+	 * @return The number of series.
+	 */
+	std::size_t columns() const {
+		return sources.size();
+	}
+	
+	/**
+	 * @return The aligned X-coordinates, in increasing order.
+	 */
+	const double *x() const {
+		return xs.data();
+	}
+	
+	/**
+	 * @param i The index of the series, in the order they were added.
+	 * @return The values of the series at the aligned coordinates.
+	 */
+	const double *column(std::size_t i) const {
+		return values[i].data();
+	}
+	
+private:
+	Interpolation mode;
+	std::vector<const Samples*> sources;
+	std::vector<std::vector<double>> values;
+	std::vector<double> xs;
+	std::vector<std::size_t> cursor, end;
+	
+	// The value at x, given the first sample after it.
+	double valueAt(const Samples &s, std::size_t next, double x) const {
+		const double *sx = s.xValues(), *sy = s.yValues();
+		const bool before = next > 0, after = next < s.size();
+		const double nan = std::numeric_limits<double>::quiet_NaN();
+		switch(mode) {
+		case PREVIOUS:
+			return before ? sy[next-1] : nan;
+		case NEAREST:
+			if(before && after)
+				return x-sx[next-1] <= sx[next]-x ? sy[next-1] : sy[next];
+			return before ? sy[next-1] : after ? sy[next] : nan;
+		case LINEAR:
+			if(before && sx[next-1] == x)
+				return sy[next-1];
+			if(before && after) {
+				const double t = (x-sx[next-1])/(sx[next]-sx[next-1]);
+				return sy[next-1]+t*(sy[next]-sy[next-1]);
+			}
+			return nan;
+		}
+		return nan;
+	}
+};
+
+/**
+ * Stacked area or bar chart of several series, e.g. the shares of services
+ * in a total: each layer is drawn on top of the sum of the layers below.
+ * The series are aligned on a grid of buckets (by default one per column)
+ * covering the drawing range, and the sums over the layers are accumulated
+ * one layer at a time over all the buckets. The sums are kept and only
+ * recomputed when the drawing range or the series change. Missing values
+ * count as 0.
+ */
+class Stacked : public Series {
+public:
+	enum Style {AREA, BARS};
+	
+	/**
+	 * @param style Whether the layers are drawn as filled areas or as bars.
+	 * @param mode How the series are sampled at the buckets.
+	 * @param bucketWidth The spacing of the buckets in X-coordinates, or 0 for one column.
+	 * @param character The character to be used for drawing, by default, is the Unicode square/block character.
+	 */
+	Stacked(Style style = AREA, Alignment::Interpolation mode = Alignment::LINEAR, 
+			double bucketWidth = 0, char character = '\0') : 
+		style(style), width(bucketWidth), character(character), alignment(mode) {}
+	
+	/**
+	 * Adds a layer on top of the previous ones.
+	 * @param s The samples of the layer; they have to outlive the series.
+	 * @param color The color of the layer.
+	 */
+	void add(const Samples &s, int8_t color) {
+		alignment.add(s);
+		layers.push_back({&s, color, 0});
+		valid = false;
+	}
+	
+	void bounds(double &minX, double &minY, double &maxX, double &maxY) const override {
+		double x1 = std::numeric_limits<double>::infinity(), x2 = -x1;
+		for(const Layer &l : layers) {
+			if(l.source->size() > 0) {
+				x1 = std::min(x1, l.source->xValues()[0]);
+				x2 = std::max(x2, l.source->xValues()[l.source->size()-1]);
+			}
+		}
+		if(!(x1 <= x2))
+			return;
+		
+		// The sums at the samples of all the layers.
+		Alignment a = alignment;
+		a.align(x1, x2);
+		std::vector<double> sum(a.size(), 0.0);
+		minY = std::min(minY, 0.0);
+		for(std::size_t j = 0; j < a.columns(); j++) {
+			accumulate(a.column(j), sum.data(), sum.data(), sum.size());
+			for(double v : sum)
+				maxY = std::max(maxY, v);
+		}
+		minX = std::min(minX, x1);
+		maxX = std::max(maxX, x2);
+	}
+	
+	void draw(Plot &p) override {
+		double x1, x2;
+		visibleX(p, x1, x2);
+		const double step = width > 0 ? width : (x2-x1)/p.w;
+		if(layers.empty() || !(step > 0))
+			return;
+		
+		bool changed = !valid || x1 != lastX1 || x2 != lastX2 || step != lastStep;
+		for(Layer &l : layers) {
+			changed |= l.revision != l.source->revision();
+			l.revision = l.source->revision();
+		}
+		if(changed) {
+			alignment.align(x1, x2, step);
+			const std::size_t n = alignment.size();
+			sums.resize(layers.size()*n);
+			for(std::size_t j = 0; j < layers.size(); j++)
+				accumulate(alignment.column(j), j ? &sums[(j-1)*n] : nullptr, &sums[j*n], n);
+			lastX1 = x1;
+			lastX2 = x2;
+			lastStep = step;
+			valid = true;
+		}
+		
+		const std::size_t n = alignment.size();
+		const double *xs = alignment.x();
+		for(std::size_t j = 0; j < layers.size(); j++) {
+			const double *hi = &sums[j*n], *lo = j ? &sums[(j-1)*n] : nullptr;
+			const int8_t color = layers[j].color;
+			for(std::size_t i = 0; i < n; i++) {
+				const double l = lo ? lo[i] : 0;
+				if(style == BARS) {
+					if(hi[i] != l)
+						drawBand(p, xs[i]-step*0.4, l, hi[i], xs[i]+step*0.4, l, hi[i], 
+								 color, character);
+				}
+				else if(i > 0)
+					drawBand(p, xs[i-1], lo ? lo[i-1] : 0, hi[i-1], xs[i], l, hi[i], 
+							 color, character);
+			}
+		}
+	}
+	
+private:
+	struct Layer {
+		const Samples *source;
+		int8_t color;
+		std::size_t revision;
+	};
+	
+	Style style;
+	double width;
+	char character;
+	Alignment alignment;
+	std::vector<Layer> layers;
+	// The sums of the layers up to each one, one array of buckets per layer.
+	std::vector<double> sums;
+	bool valid = false;
+	double lastX1 = 0, lastX2 = 0, lastStep = 0;
+	
+	// Adds the values of a layer to the sums below it, in a loop free of
+	// branches.
+	static void accumulate(const double *v, const double *below, double *out, std::size_t n) {
+		if(below == nullptr) {
+			for(std::size_t i = 0; i < n; i++)
+				out[i] = v[i] == v[i] ? v[i] : 0;
+			return;
+		}
+		for(std::size_t i = 0; i < n; i++)
+			out[i] = below[i]+(v[i] == v[i] ? v[i] : 0);
+	}
+};
+
+/**
+ * Staircase line of samples of a quantity that changes in steps, e.g. a
+ * gauge or a setting: between two samples it stays level and changes at once.
+ * The horizontal and vertical parts are filled directly as spans of
+ * sub-pixels, and only one point per sample is stored.
+ */
+class Steps : public Series {
+public:
+	/**
+	 * Where the value changes between two samples: at the earlier one (PRE,
+	 * each sample holding since the previous one), at the later one (POST,
+	 * each sample holding until the next one), or halfway (MID).
+	 */
+	enum Mode {PRE, POST, MID};
+	
+	/**
+	 * @param mode Where the value changes between samples.
+	 * @param color The color of the line.
+	 * @param character The character to be used for drawing the line, by default, is the Unicode square/block character.
+	 */
+	Steps(Mode mode = POST, int8_t color = WHITE, char character = '\0') : 
+		mode(mode), color(color), character(character) {}
+	
+	/**
+	 * Adds a sample. A NaN value breaks the line.
+	 * @param x The X-coordinate of the sample.
+	 * @param y The value of the sample.
+	 */
+	void add(double x, double y) {
+		samples.add(x, y);
+	}
+	
+	/**
+	 * Adds many samples.
+	 * @param x The X-coordinates of the samples.
+	 * @param y The values of the samples.
+	 * @param n The number of samples.
+	 */
+	void add(const double *x, const double *y, std::size_t n) {
+		samples.add(x, y, n);
+	}
+	
+	/**
+	 * Removes all samples.
+	 */
+	void clear() {
+		samples.clear();
+	}
+	
+	void bounds(double &minX, double &minY, double &maxX, double &maxY) const override {
+		samples.bounds(minX, minY, maxX, maxY);
+	}
+	
+	void draw(Plot &p) override {
+		std::size_t from, to;
+		samples.visible(p, from, to);
+		const double *xs = samples.xValues(), *ys = samples.yValues();
+		for(std::size_t i = from+1; i < to; i++) {
+			const double x1 = xs[i-1], y1 = ys[i-1], x2 = xs[i], y2 = ys[i];
+			if(!finite(y1) || !finite(y2))
+				continue;
+			
+			const double x = mode == PRE ? x1 : mode == POST ? x2 : (x1+x2)/2;
+			drawHorizontal(p, x1, x, y1, color, character);
+			drawVertical(p, x, y1, y2, color, character);
+			drawHorizontal(p, x, x2, y2, color, character);
+		}
+	}
+	
+private:
+	Mode mode;
+	int8_t color;
+	char character;
+	Samples samples;
+};
+
+/**
+ * Scrolling waterfall display (e.g. a spectrogram) drawn in the buffer of a plot.
+ * Each pushed line of values moves the history by one sub-pixel: by half a
+ * character downwards, or by one character to the left. The buffer is moved
+ * in place and only the new line is rasterized. When printing, a downward
+ * waterfall uses a terminal scroll region, so that only the new lines are
+ * sent; this needs the plot to start at the top-left corner of the terminal
+ * and to have no Y axis labels, otherwise the whole plot is printed.
+ * With an inverted Y axis, a downward waterfall grows upwards.
+ */
+class Waterfall {
+public:
+	enum Direction {DOWN, LEFT};
+	
+	/**
+	 * Clears the buffer of the plot and starts an empty waterfall in it.
+	 * 
+	 * @param p The plot whose buffer is used.
+	 * @param direction The direction in which the history moves.
+	 * @param map Colors of the values. Without a range, the range of the values
+	 * pushed so far is used for each new line.
+	 */
+	Waterfall(Plot &p, Direction direction = DOWN, const Colormap &map = Colormap()) :
+			plot(p), direction(direction), map(map) {
+		plot.clearPlot();
+	}
+	
+	/**
+	 * Adds a new line of values, resampled to the width of the plot
+	 * (or to the height in sub-pixels, for a waterfall moving left).
+	 * 
+	 * @param values The values, from left to right or from top to bottom.
+	 * @param n The number of values.
+	 */
+	void push(const double *values, std::size_t n) {
+		const int w = plot.w, h = plot.h;
+		Plot::Cell *buf = plot.printBuf;
+		if(n == 0 || map.colors.empty())
+			return;
+		
+		for(std::size_t i = 0; i < n; i++)
+			if(finite(values[i])) {
+				low = std::min(low, values[i]);
+				high = std::max(high, values[i]);
+			}
+		
+		if(direction == DOWN) {
+			resample(values, n, w);
+			if(!half) {
+				std::memmove(buf+w, buf, sizeof(Plot::Cell)*w*(h-1));
+				scrolled++;
+				for(int x = 0; x < w; x++) {
+					plot.setCell(x, 0, colors[x], Plot::BLOCK);
+					plot.setCell(x, 1, colors[x], Plot::BLOCK);
+				}
+			}
+			else
+				for(int x = 0; x < w; x++) {
+					plot.setCell(x, 1, previous[x], Plot::BLOCK);
+					plot.setCell(x, 0, colors[x], Plot::BLOCK);
+				}
+			
+			previous.swap(colors);
+			half = !half;
+			changed = true;
+		}
+		else {
+			resample(values, n, h*2);
+			for(int y = 0; y < h; y++)
+				std::memmove(buf+y*w, buf+y*w+1, sizeof(Plot::Cell)*(w-1));
+			for(int y = 0; y < h*2; y++)
+				plot.setCell(w-1, y, colors[y], Plot::BLOCK);
+			full = true;
+		}
+	}
+	
+	/**
+	 * Encodes the changes since the last call, positioned from the top-left
+	 * corner of the terminal.
+	 * @param out The string to which the output is appended.
+	 */
+	void encode(std::string &out) {
+		const int h = plot.h;
+		if(full || direction != DOWN || !plot.yFormat.empty() || scrolled >= h) {
+			out += "\x1b[H";
+			plot.encode(out);
+		}
+		else if(changed) {
+			// The line below the new ones may have been completed after it
+			// was last printed.
+			const int rows = std::min(scrolled+1, h);
+			Plot::appendf(out, "\x1b[1;%dr", h);
+			if(scrolled)
+				Plot::appendf(out, plot.invertedY ? "\x1b[%dS" : "\x1b[%dT", scrolled);
+			out += "\x1b[r";
+			
+			for(int y = 0; y < rows; y++) {
+				Plot::appendf(out, "\x1b[%d;1H", plot.invertedY ? h-y : y+1);
+				Plot::encodeRun(plot.printBuf+y*plot.w, plot.w, out);
+			}
+			Plot::appendf(out, "\x1b[0m\x1b[%d;1H", h+1+!plot.xFormat.empty());
+		}
+		
+		full = changed = false;
+		scrolled = 0;
+	}
+	
+	/**
+	 * Prints the changes since the last call to stdout.
+	 */
+	void print() {
+		std::string out;
+		encode(out);
+		fwrite(out.data(), 1, out.size(), stdout);
+	}
+	
+private:
+	Plot &plot;
+	Direction direction;
+	Colormap map;
+	double low = std::numeric_limits<double>::infinity(), high = -low;
+	std::vector<int8_t> colors, previous;
+	bool half = false, full = true, changed = false;
+	int scrolled = 0;
+	
+	void resample(const double *values, std::size_t n, int size) {
+		const double l = map.autoRange() ? low : map.low;
+		double r = map.autoRange() ? high : map.high;
+		if(map.autoRange() && !(l < r))
+			r = l+1;
+		colors.resize(size);
+		previous.resize(size);
+		
+		for(int i = 0; i < size; i++) {
+			const std::size_t a = static_cast<std::size_t>(i)*n/size;
+			const std::size_t b = std::max(a+1, static_cast<std::size_t>(i+1)*n/size);
+			double sum = 0;
+			int count = 0;
+			for(std::size_t j = a; j < b; j++) {
+				const bool ok = finite(values[j]);
+				sum += ok ? values[j] : 0;
+				count += ok;
+			}
+			colors[i] = count ? map.color(sum/count, l, r) : plot.background;
+		}
+	}
+};
+
+/**
+ * Prints consecutive frames of a plot to a terminal, sending only what changed.
+ * When the content of the plot moved as a whole, e.g. a strip chart advanced
+ * by a column, the terminal is asked to move it (vertically with a scroll
+ * region, horizontally with column deletion and insertion inside left and
+ * right margins) and only the cells that are still different are sent.
+ * Frames are positioned from the top-left corner of the terminal.
+ */
+class Presenter {
+public:
+	/**
+	 * @param columnScrolling Whether horizontal moves may be used. They need
+	 * DECSLRM margins and DECIC/DECDC, which e.g. xterm supports but many
+	 * other terminals do not.
+	 * @param maxShift The largest move looked for, in characters or lines.
+	 */
+	Presenter(bool columnScrolling = false, int maxShift = 8) : 
+		columnScrolling(columnScrolling), maxShift(maxShift) {}
+	
+	/**
+	 * Makes the next frame be sent whole, e.g. after the screen was cleared.
+	 */
+	void reset() {
+		valid = false;
+	}
+	
+	/**
+	 * Encodes the buffered plot as changes to the previously encoded frame.
+	 * 
+	 * @param p The rendered plot.
+	 * @param out The string to which the output is appended.
+	 */
+	void encode(const Plot &p, std::string &out) {
+		p.snapshot(current);
+		const int w = current.w, h = current.h;
+		
+		if(!valid || previous.w != w || previous.h != h || 
+				previous.invertedY != current.invertedY) {
+			out += "\x1b[H";
+			current.encode(out);
+		}
+		else {
+			int bestX = 0, bestY = 0;
+			const long unshifted = changed(0, 0, w*h);
+			long best = unshifted;
+			for(int k = 1; k <= maxShift; k++)
+				for(int sign = -1; sign <= 1; sign += 2) {
+					long c;
+					if(k < h && (c = changed(0, sign*k, best)) < best) {
+						best = c;
+						bestX = 0;
+						bestY = sign*k;
+					}
+					if(columnScrolling && k < w && (c = changed(sign*k, 0, best)) < best) {
+						best = c;
+						bestX = sign*k;
+						bestY = 0;
+					}
+				}
+			
+			// A move also costs the escape sequences and, when vertical,
+			// rewriting the Y axis labels, so it has to save a good part.
+			if(best*2 > unshifted)
+				bestX = bestY = 0;
+			
+			if(bestY) {
+				Plot::appendf(out, "\x1b[0m\x1b[1;%dr\x1b[%d%c\x1b[r", h, 
+							  std::abs(bestY), bestY > 0 ? 'S' : 'T');
+			}
+			else if(bestX) {
+				Plot::appendf(out, "\x1b[0m\x1b[?69h\x1b[1;%ds\x1b[1;%dr\x1b[1;1H"
+							  "\x1b[%d'%c\x1b[r\x1b[?69l", w, h, 
+							  std::abs(bestX), bestX > 0 ? '~' : '}');
+			}
+			
+			shift(bestX, bestY);
+			Plot::encodeDiff(shifted.data(), current.cells.data(), w, h, current.invertedY,
+							 bestY ? nullptr : &previous.axes(), current.axes(), out);
+		}
+		
+		std::swap(previous, current);
+		valid = true;
+	}
+	
+	/**
+	 * Prints the buffered plot to stdout as changes to the previous frame.
+	 * @param p The rendered plot.
+	 */
+	void print(const Plot &p) {
+		std::string out;
+		encode(p, out);
+		fwrite(out.data(), 1, out.size(), stdout);
+		fflush(stdout);
+	}
+	
+private:
+	bool columnScrolling;
+	int maxShift;
+	bool valid = false;
+	Plot::Frame previous, current;
+	std::vector<Plot::Cell> shifted;
+	
+	// Cell moved to screen position (x, y) from (x+sx, y+sy) of the previous frame.
+	const Plot::Cell *moved(int x, int y, int sx, int sy) const {
+		const int w = previous.w, h = previous.h;
+		x += sx;
+		y += sy;
+		if(x < 0 || x >= w || y < 0 || y >= h)
+			return nullptr;
+		return &previous.cells[(previous.invertedY ? h-1-y : y)*w+x];
+	}
+	
+	long changed(int sx, int sy, long limit) const {
+		const int w = current.w, h = current.h;
+		long n = 0;
+		for(int y = 0; y < h && n < limit; y++) {
+			const Plot::Cell *c = &current.cells[(current.invertedY ? h-1-y : y)*w];
+			for(int x = 0; x < w; x++) {
+				const Plot::Cell *p = moved(x, y, sx, sy);
+				n += p == nullptr || !(*p == c[x]);
+			}
+		}
+		return n;
+	}
+	
+	void shift(int sx, int sy) {
+		const int w = current.w, h = current.h;
+		// Cells uncovered by the move never equal a real cell.
+		shifted.assign(w*h, {'\x7f', 0});
+		for(int y = 0; y < h; y++)
+			for(int x = 0; x < w; x++) {
+				const Plot::Cell *p = moved(x, y, sx, sy);
+				if(p != nullptr)
+					shifted[(current.invertedY ? h-1-y : y)*w+x] = *p;
+			}
+	}
+};
+
+/**
+ * Runs rendering, encoding and writing of consecutive frames concurrently,
+ * each stage on its own thread, so the frame rate is limited by the slowest
+ * stage rather than by the sum of all of them.
+ * Stages are connected by bounded queues and every buffer (plots, frames,
+ * encoded output) is recycled, so no allocation happens in steady state.
+ * Every frame is written from the top left corner of the terminal, over the
+ * previous one.
+ */
+class Pipeline {
+public:
+	/**
+	 * Starts the render, encode and write stages.
+	 * 
+	 * @param out The stream to which encoded frames are written, stdout by default.
+	 * @param depth The number of frames that can be in flight in each stage.
+	 */
+	Pipeline(FILE *out = stdout, int depth = 2) : out(out), 
+			freePlots(depth), renderQueue(depth), freeFrames(depth), 
+			encodeQueue(depth), freeBuffers(depth), writeQueue(depth) {
+		for(int i = 0; i < depth; i++) {
+			plots.emplace_back(new Plot);
+			frames.emplace_back(new Plot::Frame);
+			buffers.emplace_back(new std::string);
+			freePlots.push(plots.back().get());
+			freeFrames.push(frames.back().get());
+			freeBuffers.push(buffers.back().get());
+		}
+		
+		renderThread = std::thread(&Pipeline::renderStage, this);
+		encodeThread = std::thread(&Pipeline::encodeStage, this);
+		writeThread = std::thread(&Pipeline::writeStage, this);
+	}
+	
+	~Pipeline() {
+		finish();
+	}
+	
+	/**
+	 * Hands the data and settings of the plot over to the render stage.
+	 * The plot is left without data, as after clearData(), so the next frame
+	 * can be ingested right away. Blocks while all stages are busy.
+	 * Attached series are not handed over, since they keep their own data.
+	 * 
+	 * @param p The plot holding the data of the frame.
+	 */
+	void submit(Plot &p) {
+		Plot *s = nullptr;
+		freePlots.pop(s);
+		
+		if(s->w != p.w || s->h != p.h)
+			s->setSize(p.w, p.h);
+		
+		s->background = p.background;
+		s->range = p.range;
+		s->invertedY = p.invertedY;
+		s->topLeft = p.topLeft;
+		s->dx = p.dx;
+		s->dy = p.dy;
+		s->minX = p.minX;
+		s->maxX = p.maxX;
+		s->minY = p.minY;
+		s->maxY = p.maxY;
+		s->rangeLow = p.rangeLow;
+		s->rangeHigh = p.rangeHigh;
+		std::swap(s->xQuantiles, p.xQuantiles);
+		std::swap(s->yQuantiles, p.yQuantiles);
+		s->yFormat = p.yFormat;
+		s->xFormat = p.xFormat;
+		s->points.swap(p.points);
+		s->lines.swap(p.lines);
+		p.recycleData();
+		
+		renderQueue.push(s);
+	}
+	
+	/**
+	 * Waits until all submitted frames are written and stops the stages.
+	 * No frames can be submitted afterwards.
+	 */
+	void finish() {
+		renderQueue.close();
+		
+		if(renderThread.joinable())
+			renderThread.join();
+		if(encodeThread.joinable())
+			encodeThread.join();
+		if(writeThread.joinable())
+			writeThread.join();
+	}
+	
+private:
+	template<typename T>
+	class Queue {
+	public:
+		Queue(int capacity) : capacity(capacity) {}
+		
+		void push(T item) {
+			std::unique_lock<std::mutex> lock(mutex);
+			notFull.wait(lock, [this]{return items.size() < capacity;});
+			items.push_back(item);
+			notEmpty.notify_one();
+		}
+		
+		bool pop(T &item) {
+			std::unique_lock<std::mutex> lock(mutex);
+			notEmpty.wait(lock, [this]{return !items.empty() || closed;});
+			if(items.empty())
+				return false;
+			
+			item = items.front();
+			items.pop_front();
+			notFull.notify_one();
+			return true;
+		}
+		
+		void close() {
+			std::lock_guard<std::mutex> lock(mutex);
+			closed = true;
+			notEmpty.notify_all();
+		}
+		
+	private:
+		std::deque<T> items;
+		std::size_t capacity;
+		bool closed = false;
+		std::mutex mutex;
+		std::condition_variable notFull, notEmpty;
+	};
+	
+	FILE *out;
+	std::vector<std::unique_ptr<Plot>> plots;
+	std::vector<std::unique_ptr<Plot::Frame>> frames;
+	std::vector<std::unique_ptr<std::string>> buffers;
+	Queue<Plot*> freePlots, renderQueue;
+	Queue<Plot::Frame*> freeFrames, encodeQueue;
+	Queue<std::string*> freeBuffers, writeQueue;
+	std::thread renderThread, encodeThread, writeThread;
+	
+	void renderStage() {
+		Plot *s = nullptr;
+		while(renderQueue.pop(s)) {
+			s->clearPlot();
+			s->render();
+			
+			Plot::Frame *f = nullptr;
+			freeFrames.pop(f);
+			s->snapshot(*f);
+			s->recycleData();
+			freePlots.push(s);
+			encodeQueue.push(f);
+		}
+		encodeQueue.close();
+	}
+	
+	void encodeStage() {
+		Plot::Frame *f = nullptr;
+		while(encodeQueue.pop(f)) {
+			std::string *b = nullptr;
+			freeBuffers.pop(b);
+			// Homes the cursor, so each frame replaces the previous one.
+			b->assign("\x1b[H");
+			f->encode(*b);
+			freeFrames.push(f);
+			writeQueue.push(b);
+		}
+		writeQueue.close();
+	}
+	
+	void writeStage() {
+		std::string *b = nullptr;
+		while(writeQueue.pop(b)) {
+			fwrite(b->data(), 1, b->size(), out);
+			fflush(out);
+			freeBuffers.push(b);
+		}
+	}
+};
+
+/**
+ * Serves one plot to many terminals over a Unix domain socket.
+ * Every published frame is rendered and encoded once, both as a full frame
+ * and as a difference to the previous one, and the same bytes are sent to all
+ * clients. A client that has not yet received the previous frame skips frames
+ * until it catches up and then receives a full frame, so a slow terminal never
+ * stalls the server or the other clients.
+ */
+class FrameServer {
+public:
+	/**
+	 * Starts listening on the specified socket path.
+	 * An existing socket file at this path is replaced; any other file is
+	 * left alone, and the server is not opened.
+	 * @param path Path of the Unix domain socket.
+	 */
+	FrameServer(const std::string &path) : path(path) {
+		sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		if(path.size() >= sizeof(addr.sun_path))
+			return;
+		
+		strcpy(addr.sun_path, path.c_str());
+		struct stat st;
+		if(lstat(path.c_str(), &st) == 0) {
+			if(!S_ISSOCK(st.st_mode))
+				return;
+			unlink(path.c_str());
+		}
+		
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if(fd < 0)
+			return;
+		
+		if(bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0 ||
+				listen(fd, 16) < 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	
+	~FrameServer() {
+		for(const Client &c : clients)
+			close(c.fd);
+		
+		if(fd >= 0) {
+			close(fd);
+			unlink(path.c_str());
+		}
+	}
+	
+	/**
+	 * @return True if the server is listening.
+	 */
+	bool isOpen() const {
+		return fd >= 0;
+	}
+	
+	/**
+	 * @return The number of connected clients.
+	 */
+	std::size_t clientCount() const {
+		return clients.size();
+	}
+	
+	/**
+	 * Accepts new clients and sends them the buffered plot.
+	 * The plot should be rendered before publishing.
+	 * @param p The plot to publish.
+	 */
+	void publish(const Plot &p) {
+		acceptClients();
+		flush();
+		
+		p.snapshot(current);
+		full.clear();
+		diff.clear();
+		
+		for(Client &c : clients) {
+			if(!c.pending.empty()) {
+				c.needsFull = true;
+				continue;
+			}
+			
+			if(c.needsFull) {
+				if(full.empty()) {
+					full = "\x1b[2J\x1b[H";
+					current.encode(full);
+				}
+				c.pending = full;
+				c.needsFull = false;
+			}
+			else {
+				if(diff.empty())
+					current.encodeDiff(previous, diff);
+				c.pending = diff;
+			}
+		}
+		
+		std::swap(previous, current);
+		flush();
+	}
+	
+	/**
+	 * Sends data that did not fit into the clients' sockets during publish().
+	 * @param timeout How long to wait for slow clients, in milliseconds.
+	 */
+	void flush(int timeout = 0) {
+		std::vector<pollfd> fds;
+		for(const Client &c : clients)
+			if(!c.pending.empty())
+				fds.push_back({c.fd, POLLOUT, 0});
+		
+		if(fds.empty() || (timeout > 0 && poll(fds.data(), fds.size(), timeout) <= 0))
+			return;
+		
+		for(std::size_t i = 0; i < clients.size();) {
+			if(sendPending(clients[i]))
+				i++;
+			else {
+				close(clients[i].fd);
+				clients.erase(clients.begin()+i);
+			}
+		}
+	}
+	
+private:
+	struct Client {
+		int fd;
+		std::string pending;
+		bool needsFull;
+	};
+	
+	std::string path;
+	int fd = -1;
+	std::vector<Client> clients;
+	Plot::Frame previous, current;
+	std::string full, diff;
+	
+	void acceptClients() {
+		if(fd < 0)
+			return;
+		
+		int c;
+		while((c = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+			clients.push_back({c, "", true});
+	}
+	
+	bool sendPending(Client &c) {
+		std::size_t sent = 0;
+		while(sent < c.pending.size()) {
+			ssize_t n = ::send(c.fd, c.pending.data()+sent, c.pending.size()-sent,
+							   MSG_NOSIGNAL);
+			if(n > 0)
+				sent += n;
+			else if(n < 0 && errno == EINTR)
+				continue;
+			else if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				break;
+			else
+				return false;
+		}
+		c.pending.erase(0, sent);
+		return true;
+	}
+};
+
+/**
+ * Displays the frames of a FrameServer in the terminal.
+ */
+class FrameClient {
+public:
+	/**
+	 * Connects to the server listening on the specified socket path.
+	 * @param path Path of the Unix domain socket.
+	 */
+	FrameClient(const std::string &path) {
+		sockaddr_un addr = {};
+		addr.sun_family = AF_UNIX;
+		if(path.size() >= sizeof(addr.sun_path))
+			return;
+		
+		strcpy(addr.sun_path, path.c_str());
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if(fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0) {
+			close(fd);
+			fd = -1;
+		}
+	}
+	
+	~FrameClient() {
+		if(fd >= 0)
+			close(fd);
+	}
+	
+	/**
+	 * @return True if the client is connected.
+	 */
+	bool isOpen() const {
+		return fd >= 0;
+	}
+	
+	/**
+	 * Writes received frames to the output until the server disconnects.
+	 * @param out File descriptor of the terminal, stdout by default.
+	 */
+	void run(int out = STDOUT_FILENO) {
+		char buf[1<<16];
+		ssize_t n;
+		while(fd >= 0 && ((n = read(fd, buf, sizeof(buf))) > 0 || 
+				(n < 0 && errno == EINTR))) {
+			for(ssize_t done = 0, m; done < n; done += m)
+				if((m = write(out, buf+done, n-done)) < 0 && errno != EINTR)
+					return;
+				else if(m < 0)
+					m = 0;
+		}
+	}
+	
+private:
+	int fd = -1;
+};
+
+namespace SharedFrame {
+	const uint32_t MAGIC = 0x53435046;
+	const int SLOTS = 3;
+	const int FORMAT_SIZE = 32;
+	
+	struct Header {
+		uint32_t magic;
+		int32_t w, h;
+		std::atomic<uint64_t> published;
+		std::atomic<uint32_t> latest;
+	};
+	
+	struct Slot {
+		std::atomic<uint64_t> seq;
+		bool invertedY;
+		Plot::Point topLeft;
+		double dx, dy;
+		char yFormat[FORMAT_SIZE], xFormat[FORMAT_SIZE];
+		
+		Plot::Cell *cells() {
+			return reinterpret_cast<Plot::Cell*>(this+1);
+		}
+	};
+	
+	inline std::size_t slotSize(int w, int h) {
+		std::size_t s = sizeof(Slot)+sizeof(Plot::Cell)*w*h;
+		return (s+alignof(Slot)-1)/alignof(Slot)*alignof(Slot);
+	}
+	
+	inline std::size_t size(int w, int h) {
+		return sizeof(Header)+slotSize(w, h)*SLOTS;
+	}
+	
+	inline Slot *slot(Header *hd, int i) {
+		return reinterpret_cast<Slot*>(reinterpret_cast<char*>(hd+1)+
+			slotSize(hd->w, hd->h)*i);
+	}
+}
+
+/**
+ * Publishes rendered frames of a plot in shared memory, where any number of
+ * SharedFrameReader instances in other processes can display them.
+ * The memory holds three frame buffers: the plot renders directly into one
+ * that no reader is expected to use, and a sequence lock tells readers
+ * whether the frame they copied was overwritten meanwhile. Publishing never
+ * waits for the readers.
+ */
+class SharedFrameWriter {
+public:
+	/**
+	 * Creates the shared memory object, replacing an existing one.
+	 * 
+	 * @param name Name of the object, as for shm_open(), e.g. "/plot".
+	 * @param length Width of published plots in characters.
+	 * @param lines Height of published plots in lines.
+	 */
+	SharedFrameWriter(const std::string &name, int length, int lines) : name(name) {
+		size = SharedFrame::size(length, lines);
+		shm_unlink(name.c_str());
+		
+		int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+		if(fd < 0)
+			return;
+		
+		void *m = MAP_FAILED;
+		if(ftruncate(fd, size) == 0)
+			m = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if(m == MAP_FAILED) {
+			shm_unlink(name.c_str());
+			return;
+		}
+		
+		header = static_cast<SharedFrame::Header*>(m);
+		header->w = length;
+		header->h = lines;
+		header->published.store(0);
+		header->latest.store(0);
+		for(int i = 0; i < SharedFrame::SLOTS; i++)
+			SharedFrame::slot(header, i)->seq.store(0);
+		header->magic = SharedFrame::MAGIC;
+	}
+	
+	~SharedFrameWriter() {
+		if(header != nullptr) {
+			munmap(header, size);
+			shm_unlink(name.c_str());
+		}
+	}
+	
+	/**
+	 * @return True if the shared memory is available.
+	 */
+	bool isOpen() const {
+		return header != nullptr;
+	}
+	
+	/**
+	 * Renders the plot into the next free frame buffer and publishes it.
+	 * The plot's own buffer is left untouched.
+	 * 
+	 * @param p The plot to publish, of the size given to the constructor.
+	 * @return False if the plot has a different size.
+	 */
+	bool publish(Plot &p) {
+		if(header == nullptr || p.w != header->w || p.h != header->h)
+			return false;
+		
+		const uint32_t i = (header->latest.load(std::memory_order_relaxed)+1)%
+			SharedFrame::SLOTS;
+		SharedFrame::Slot *s = SharedFrame::slot(header, i);
+		const uint64_t seq = s->seq.load(std::memory_order_relaxed);
+		s->seq.store(seq+1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		
+		Plot::Cell *own = p.printBuf;
+		p.printBuf = s->cells();
+		p.clearPlot();
+		p.render();
+		p.printBuf = own;
+		
+		s->invertedY = p.invertedY;
+		s->topLeft = p.topLeft;
+		s->dx = p.dx;
+		s->dy = p.dy;
+		copyFormat(s->yFormat, p.yFormat);
+		copyFormat(s->xFormat, p.xFormat);
+		
+		s->seq.store(seq+2, std::memory_order_release);
+		header->latest.store(i, std::memory_order_release);
+		header->published.fetch_add(1, std::memory_order_release);
+		return true;
+	}
+	
+private:
+	std::string name;
+	std::size_t size = 0;
+	SharedFrame::Header *header = nullptr;
+	
+	static void copyFormat(char *to, const std::string &from) {
+		std::size_t n = std::min<std::size_t>(from.size(), SharedFrame::FORMAT_SIZE-1);
+		memcpy(to, from.data(), n);
+		to[n] = '\0';
+	}
+};
+
+/**
+ * Reads frames published by a SharedFrameWriter, usually in another process.
+ */
+class SharedFrameReader {
+public:
+	/**
+	 * Opens an existing shared memory object.
+	 * @param name Name of the object given to the writer.
+	 */
+	SharedFrameReader(const std::string &name) {
+		int fd = shm_open(name.c_str(), O_RDONLY, 0);
+		if(fd < 0)
+			return;
+		
+		struct stat st;
+		void *m = MAP_FAILED;
+		if(fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(SharedFrame::Header)))
+			m = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		close(fd);
+		if(m == MAP_FAILED)
+			return;
+		
+		header = static_cast<SharedFrame::Header*>(m);
+		size = st.st_size;
+		if(header->magic != SharedFrame::MAGIC || 
+				size < SharedFrame::size(header->w, header->h)) {
+			munmap(m, size);
+			header = nullptr;
+		}
+	}
+	
+	~SharedFrameReader() {
+		if(header != nullptr)
+			munmap(header, size);
+	}
+	
+	/**
+	 * @return True if the shared memory is available.
+	 */
+	bool isOpen() const {
+		return header != nullptr;
+	}
+	
+	/**
+	 * Copies the most recently published frame, if it was not read yet.
+	 * 
+	 * @param f The frame to overwrite.
+	 * @return True if a new frame was copied.
+	 */
+	bool read(Plot::Frame &f) {
+		if(header == nullptr)
+			return false;
+		
+		const uint64_t published = header->published.load(std::memory_order_acquire);
+		if(published == lastRead)
+			return false;
+		
+		f.w = header->w;
+		f.h = header->h;
+		f.cells.resize(f.w*f.h);
+		
+		while(true) {
+			SharedFrame::Slot *s = SharedFrame::slot(header, 
+				header->latest.load(std::memory_order_acquire));
+			const uint64_t seq = s->seq.load(std::memory_order_acquire);
+			if(seq%2)
+				continue;
+			
+			memcpy(f.cells.data(), s->cells(), sizeof(Plot::Cell)*f.w*f.h);
+			f.invertedY = s->invertedY;
+			f.topLeft = s->topLeft;
+			f.dx = s->dx;
+			f.dy = s->dy;
+			char yFormat[SharedFrame::FORMAT_SIZE], xFormat[SharedFrame::FORMAT_SIZE];
+			memcpy(yFormat, s->yFormat, sizeof(yFormat));
+			memcpy(xFormat, s->xFormat, sizeof(xFormat));
+			
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if(s->seq.load(std::memory_order_relaxed) == seq) {
+				yFormat[sizeof(yFormat)-1] = xFormat[sizeof(xFormat)-1] = '\0';
+				f.yFormat = yFormat;
+				f.xFormat = xFormat;
+				break;
+			}
+		}
+		
+		lastRead = published;
+		return true;
+	}
+	
+private:
+	std::size_t size = 0;
+	SharedFrame::Header *header = nullptr;
+	uint64_t lastRead = 0;
+};
+
+namespace SampleRing {
+	const uint32_t MAGIC = 0x53435052;
+	
+	struct Sample {
+		uint32_t series;
+		double x, y;
+	};
+	
+	struct Header {
+		uint32_t magic;
+		uint32_t capacity;
+		alignas(64) std::atomic<uint64_t> head;
+		alignas(64) std::atomic<uint64_t> tail;
+		
+		Sample *samples() {
+			return reinterpret_cast<Sample*>(this+1);
+		}
+	};
+	
+	inline std::size_t size(uint32_t capacity) {
+		return sizeof(Header)+sizeof(Sample)*capacity;
+	}
+}
+
+/**
+ * Sends samples to a PlotDaemon through a single-producer single-consumer
+ * ring in shared memory. Pushing a sample is a store and an atomic counter
+ * update, it never blocks and never makes a system call.
+ * One writer should be used by one thread only.
+ */
+class SampleWriter {
+public:
+	/**
+	 * Creates the ring, replacing an existing one with the same name.
+	 * 
+	 * @param name Name of the shared memory object, as for shm_open(), e.g. "/plot-client1".
+	 * @param capacity Number of samples the ring can hold, rounded up to a power of two.
+	 */
+	SampleWriter(const std::string &name, uint32_t capacity = 1<<16) : name(name) {
+		uint32_t c = 1;
+		while(c < capacity)
+			c <<= 1;
+		size = SampleRing::size(c);
+		shm_unlink(name.c_str());
+		
+		int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+		if(fd < 0)
+			return;
+		
+		void *m = MAP_FAILED;
+		if(ftruncate(fd, size) == 0)
+			m = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+		close(fd);
+		if(m == MAP_FAILED) {
+			shm_unlink(name.c_str());
+			return;
+		}
+		
+		ring = static_cast<SampleRing::Header*>(m);
+		ring->capacity = c;
+		ring->head.store(0);
+		ring->tail.store(0);
+		ring->magic = SampleRing::MAGIC;
+		samples = ring->samples();
+		mask = c-1;
+	}
+	
+	~SampleWriter() {
+		if(ring != nullptr) {
+			munmap(ring, size);
+			shm_unlink(name.c_str());
+		}
+	}
+	
+	/**
+	 * @return True if the shared memory is available.
+	 */
+	bool isOpen() const {
+		return ring != nullptr;
+	}
+	
+	/**
+	 * Adds a sample to the ring.
+	 * 
+	 * @param series Identifier of the series the sample belongs to.
+	 * @param x The X-coordinate of the sample.
+	 * @param y The Y-coordinate of the sample.
+	 * @return False if the ring is full and the sample was dropped.
+	 */
+	bool push(uint32_t series, double x, double y) {
+		if(head-tail > mask) {
+			tail = ring->tail.load(std::memory_order_acquire);
+			if(head-tail > mask)
+				return false;
+		}
+		
+		samples[head&mask] = {series, x, y};
+		ring->head.store(++head, std::memory_order_release);
+		return true;
+	}
+	
+private:
+	std::string name;
+	std::size_t size = 0;
+	SampleRing::Header *ring = nullptr;
+	SampleRing::Sample *samples = nullptr;
+	uint64_t head = 0, tail = 0, mask = 0;
+};
+
+/**
+ * Collects samples from many SampleWriter processes into one plot.
+ * Consecutive samples of a series are joined with lines.
+ */
+class PlotDaemon {
+public:
+	/**
+	 * @param p The plot to which the samples are added.
+	 */
+	PlotDaemon(Plot &p) : plot(p) {}
+	
+	~PlotDaemon() {
+		for(const Ring &r : rings)
+			munmap(r.header, r.size);
+	}
+	
+	/**
+	 * Starts reading samples from the ring of a client.
+	 * @param name Name of the shared memory object given to the SampleWriter.
+	 * @return False if the ring does not exist or is not valid.
+	 */
+	bool attach(const std::string &name) {
+		int fd = shm_open(name.c_str(), O_RDWR, 0);
+		if(fd < 0)
+			return false;
+		
+		struct stat st;
+		void *m = MAP_FAILED;
+		if(fstat(fd, &st) == 0 && st.st_size >= static_cast<off_t>(sizeof(SampleRing::Header)))
+			m = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+		if(m == MAP_FAILED)
+			return false;
+		
+		// The capacity is read once, the client could change it later.
+		SampleRing::Header *h = static_cast<SampleRing::Header*>(m);
+		const uint32_t capacity = h->capacity;
+		if(h->magic != SampleRing::MAGIC || capacity == 0 || (capacity & (capacity-1)) != 0 || 
+				static_cast<std::size_t>(st.st_size) < SampleRing::size(capacity)) {
+			munmap(m, st.st_size);
+			return false;
+		}
+		
+		rings.push_back({h, static_cast<std::size_t>(st.st_size), capacity-1u});
+		return true;
+	}
+	
+	/**
+	 * Sets how a series is drawn.
+	 * By default, series are drawn with the Unicode block character in the
+	 * colors following BLACK, chosen by the series identifier.
+	 * 
+	 * @param series Identifier of the series.
+	 * @param color The color of the series.
+	 * @param character The character to be used for drawing the series.
+	 */
+	void setStyle(uint32_t series, int8_t color, char character = '\0') {
+		Track &s = get(series);
+		s.color = color;
+		s.character = character;
+	}
+	
+	/**
+	 * Moves all samples waiting in the rings to the plot.
+	 * @return The number of samples read.
+	 */
+	std::size_t poll() {
+		std::size_t n = 0;
+		for(const Ring &r : rings) {
+			const uint64_t head = r.header->head.load(std::memory_order_acquire);
+			const SampleRing::Sample *samples = r.header->samples();
+			uint64_t tail = r.header->tail.load(std::memory_order_relaxed);
+			// A client writing a wrong head can make the ring look fuller
+			// than it is; at most one ring of samples is read.
+			if(head-tail > r.mask+1)
+				tail = head-(r.mask+1);
+			
+			for(; tail != head; tail++, n++) {
+				const SampleRing::Sample &a = samples[tail&r.mask];
+				Track &s = get(a.series);
+				if(s.started)
+					plot.line(s.last.x, s.last.y, a.x, a.y, s.color, s.character);
+				else
+					plot.point(a.x, a.y, s.color, s.character);
+				
+				s.last = {a.x, a.y};
+				s.started = true;
+			}
+			r.header->tail.store(tail, std::memory_order_release);
+		}
+		return n;
+	}
+	
+private:
+	struct Ring {
+		SampleRing::Header *header;
+		std::size_t size;
+		uint64_t mask;
+	};
+	
+	// The style of a series of samples and the end of its line so far.
+	struct Track {
+		int8_t color;
+		char character;
+		bool started;
+		Plot::Point last;
+	};
+	
+	Plot &plot;
+	std::vector<Ring> rings;
+	std::unordered_map<uint32_t, Track> tracks;
+	
+	Track &get(uint32_t id) {
+		auto it = tracks.find(id);
+		if(it == tracks.end())
+			it = tracks.insert({id, {static_cast<int8_t>(1+id%15), '\0', false, {0, 0}}}).first;
+		return it->second;
+	}
 };
 
 }